@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Cost of --max-steps, --max-heap and --timeout: median user time of bench/limits.ul with no limits
+# and with all three set, over RUNS interleaved runs of each. Build with -O2 first for meaningful numbers:
+#   make CXXFLAGS="-std=c++17 -O2" && bench/limits.sh
+cd "$(dirname "$0")/.." || exit 1
+ULANG=${ULANG:-./ulang}
+RUNS=${RUNS:-15}
+TIMEFORMAT=%U
+declare -a none all
+for ((r = 0; r < RUNS; r++)); do
+    none+=($({ time "$ULANG" bench/limits.ul > /dev/null; } 2>&1))
+    all+=($({ time "$ULANG" --max-steps 100000000 --max-heap 1G --timeout 600000 bench/limits.ul > /dev/null; } 2>&1))
+done
+median() { printf '%s\n' "$@" | sort -n | sed -n "$((($# + 1) / 2))p"; }
+echo "no limits:        $(median "${none[@]}")s"
+echo "all three limits: $(median "${all[@]}")s"
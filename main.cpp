@@ -2,8 +2,10 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <set>
 #include <memory>
 #include <cmath>
 #include <stdexcept>
@@ -12,7 +14,84 @@
 #include <iomanip>
 #include <limits>
 #include <functional>
+#include <unordered_map>
+#include <list>
+#include <cstdint>
+#include <charconv>
+#include <cstring>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+#include <cerrno>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <climits>
+#include <malloc.h>
+#include <fcntl.h>
+#include <bitset>
+#include <optional>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sched.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <curl/curl.h>
+// Every heap allocation goes through here so alloc_count() can prove a path allocation-free. Counted per
+// thread, like heap_bytes below, so the count is a plain increment rather than an atomic one; the
+// interpreter and its tasks all allocate on the thread running it.
+static thread_local unsigned long long heap_allocations = 0;
+// Net bytes allocated by this thread since a heap limit was set, for --max-heap. Only tracked while a
+// limit is set, and kept per thread so the accounting is a plain add: the interpreter's allocations
+// all happen on the thread running it. Blocks count by their usable size both ways, and freeing blocks
+// from before the limit cannot take the count below zero.
+static bool heap_accounting = false;
+static thread_local long long heap_bytes = 0;
+// On the thread of an interpreter with a heap limit, the interpreter's next-check step count: crossing
+// the limit zeroes it, so the error is raised at the very next loop back-edge or call.
+static thread_local long long heap_limit = 0;
+static thread_local uint64_t* heap_trip = nullptr;
+// A replacement operator new may only fail with bad_alloc, so a block the limit refuses is reported as
+// one; Interpreter::executeBlock turns it into a ResourceLimitError the script can catch.
+struct HeapLimitExceeded : std::bad_alloc {
+    const char* what() const noexcept override { return "Heap limit exceeded"; }
+};
+void* operator new(std::size_t size) {
+    ++heap_allocations;
+    // A single large block that alone would cross the limit is refused before it is allocated.
+    if (heap_accounting && heap_trip && size >= (1 << 20) && heap_bytes + (long long)size > heap_limit) throw HeapLimitExceeded();
+    if (void* p = std::malloc(size ? size : 1)) {
+        if (heap_accounting) {
+            heap_bytes += (long long)malloc_usable_size(p);
+            if (heap_trip && heap_bytes > heap_limit) *heap_trip = 0;
+        }
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+    if (heap_accounting && p) heap_bytes = std::max(0LL, heap_bytes - (long long)malloc_usable_size(p));
+    std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+    if (heap_accounting && p) heap_bytes = std::max(0LL, heap_bytes - (long long)malloc_usable_size(p));
+    std::free(p);
+}
+// Set by --stats and --trace before the interpreter starts; the error and live-object counters they
+// report are only kept while it is on, so ordinary runs pay a branch instead of an atomic update.
+static bool object_counting = false;
+// ULangErrors constructed so far; runtime errors are C++ exceptions, so this counts the throws.
+static std::atomic<unsigned long long> errors_thrown{0};
 int current_line = 1;
 int current_column = 1;
 class ULangError : public std::runtime_error {
@@ -20,16 +99,29 @@ public:
     int line;
     int column;
     std::string type;
-    ULangError(const std::string& message, const std::string& error_type, int err_line, int err_col)
-        : std::runtime_error(message), line(err_line), column(err_col), type(error_type) {}
+    // Runtime errors start unlocated and take the position of the innermost statement they unwind
+    // through, so nothing has to track positions while code runs without errors.
+    bool located;
+    ULangError(const std::string& message, const std::string& error_type, int err_line, int err_col, bool is_located = false)
+        : std::runtime_error(message), line(err_line), column(err_col), type(error_type), located(is_located) {
+        if (object_counting) errors_thrown.fetch_add(1, std::memory_order_relaxed);
+    }
     std::string getFullMessage() const {
         return "ERROR [" + type + "] Line " + std::to_string(line) + ", Column " + std::to_string(column) + ": " + what();
     }
 };
-inline void throw_lexer_error(const std::string& msg) { throw ULangError(msg, "Lexer", current_line, current_column); }
-inline void throw_parser_error(const std::string& msg) { throw ULangError(msg, "Parser", current_line, current_column); }
-inline void void_throw_runtime_error(const std::string& msg) { throw ULangError(msg, "Runtime", current_line, current_column); }
-inline void throw_runtime_error(const std::string& msg) { throw ULangError(msg, "Runtime", current_line, current_column); }
+// Errors are only raised off the normal path, so the throwers are kept out of line and marked cold:
+// callers' fast paths stay compact and a try block costs nothing until something is thrown.
+[[noreturn]] __attribute__((cold, noinline)) void throw_lexer_error(const std::string& msg) { throw ULangError(msg, "Lexer", current_line, current_column, true); }
+[[noreturn]] __attribute__((cold, noinline)) void throw_parser_error(const std::string& msg) { throw ULangError(msg, "Parser", current_line, current_column, true); }
+[[noreturn]] __attribute__((cold, noinline)) void void_throw_runtime_error(const std::string& msg) { throw ULangError(msg, "Runtime", current_line, current_column); }
+[[noreturn]] __attribute__((cold, noinline)) void throw_runtime_error(const std::string& msg) { throw ULangError(msg, "Runtime", current_line, current_column); }
+// Unlocated like any runtime error, unless the statement it happened in is given.
+[[noreturn]] __attribute__((cold, noinline)) void throw_heap_limit(int line = 0, int column = 0) {
+    std::string message = "Heap limit (" + std::to_string(heap_limit) + " bytes) exceeded";
+    if (line > 0) throw ULangError(message, "ResourceLimitError", line, column, true);
+    throw ULangError(message, "ResourceLimitError", current_line, current_column);
+}
 enum TokenKind {
     TOK_ID,
     TOK_NUMBER,
@@ -42,6 +134,11 @@ enum TokenKind {
     TOK_PERCENT,
     TOK_LT,
     TOK_GT,
+    TOK_SHL,
+    TOK_SHR,
+    TOK_AMP,
+    TOK_PIPE,
+    TOK_CARET,
     TOK_EE,
     TOK_NE,
     TOK_LPAREN,
@@ -53,6 +150,7 @@ enum TokenKind {
     TOK_COMMA,
     TOK_DOT,
     TOK_SEMICOLON,
+    TOK_AT,
     // keywords
     TOK_IF,
     TOK_ELSE,
@@ -68,6 +166,10 @@ enum TokenKind {
     TOK_RETURN,
     TOK_TRY,
     TOK_CATCH,
+    TOK_ASYNC,
+    TOK_AWAIT,
+    TOK_IMPORT,
+    TOK_FROM,
     TOK_NULL,
     TOK_TRUE,
     TOK_FALSE,
@@ -96,131 +198,251 @@ TokenKind check_keyword(const std::string& text) {
     if (text == "return") return TOK_RETURN;
     if (text == "try") return TOK_TRY;
     if (text == "catch") return TOK_CATCH;
+    if (text == "async") return TOK_ASYNC;
+    if (text == "await") return TOK_AWAIT;
+    if (text == "import") return TOK_IMPORT;
+    if (text == "from") return TOK_FROM;
     if (text == "null") return TOK_NULL;
     if (text == "true") return TOK_TRUE;
     if (text == "false") return TOK_FALSE;
     return TOK_ID;
 }
-std::vector<Token> tokenize(const std::string& source) {
-    std::vector<Token> tokens;
-    size_t i = 0;
-    current_line = 1;
-    current_column = 1;
-    while (i < source.length()) {
-        char c = source[i];
-        if (c == '\n') { i++; current_line++; current_column = 1; continue; }
-        if (c == '\r') { i++; current_column++; continue; }
-        if (isspace(static_cast<unsigned char>(c))) { i++; current_column++; continue; }
-        int start_line = current_line;
-        int start_col = current_column;
-        if (c == '"') {
-            i++; current_column++;
-            std::string s;
-            while (i < source.length()) {
-                if (source[i] == '\\') {
-                    i++; current_column++;
-                    if (i >= source.length()) throw_lexer_error("Invalid escape sequence in string literal.");
-                    char esc = source[i];
-                    if (esc == 'n') s += '\n';
-                    else if (esc == 't') s += '\t';
-                    else if (esc == 'r') s += '\r';
-                    else if (esc == '\\') s += '\\';
-                    else if (esc == '"') s += '"';
-                    else s += esc;
-                    i++; current_column++;
-                } else if (source[i] == '"') {
-                    i++; current_column++;
-                    break;
-                } else {
-                    if (source[i] == '\n') { current_line++; current_column = 1; }
-                    else current_column++;
-                    s += source[i++];
-                }
-            }
-            if (i > source.length()) throw_lexer_error("Unclosed string literal.");
-            tokens.push_back(Token(TOK_STRING_LIT, s, start_line, start_col));
-        }
-        else if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
-            std::string id;
-            while (i < source.length() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_')) {
-                id += source[i++];
-            }
-            tokens.push_back(Token(check_keyword(id), id, start_line, start_col));
-            current_column += id.length();
+// Pulls raw source bytes on demand; returns 0 at end of input.
+using ChunkReader = std::function<size_t(char*, size_t)>;
+ChunkReader readStream(std::istream& in) {
+    return [&in](char* dst, size_t n) -> size_t {
+        in.read(dst, n);
+        return (size_t)in.gcount();
+    };
+}
+// Unlike readStream, returns whatever a pipe has ready instead of waiting for a full chunk. What the
+// statements so far printed is flushed first, so a reader on the other end sees it before more
+// source is awaited.
+ChunkReader readFd(int fd) {
+    return [fd](char* dst, size_t n) -> size_t {
+        std::cout.flush();
+        while (true) {
+            ssize_t got = ::read(fd, dst, n);
+            if (got >= 0) return (size_t)got;
+            if (errno != EINTR) return 0;
         }
-        else if (isdigit(static_cast<unsigned char>(c))) {
-            std::string num;
-            while (i < source.length() && (isdigit(static_cast<unsigned char>(source[i])) || source[i] == '.')) {
-                num += source[i++];
-            }
-            tokens.push_back(Token(TOK_NUMBER, num, start_line, start_col));
-            current_column += num.length();
+    };
+}
+ChunkReader readString(const std::string& source) {
+    auto text = std::make_shared<std::string>(source);
+    auto offset = std::make_shared<size_t>(0);
+    return [text, offset](char* dst, size_t n) -> size_t {
+        size_t got = std::min(n, text->size() - *offset);
+        std::memcpy(dst, text->data() + *offset, got);
+        *offset += got;
+        return got;
+    };
+}
+// Pull-based lexer: each next() scans one token out of a small sliding buffer, so memory use is
+// bounded by the longest token rather than the size of the source.
+class Lexer {
+    ChunkReader reader;
+    std::string buf;
+    size_t pos = 0;
+    bool eof = false;
+    static const size_t CHUNK = 64 * 1024;
+    // Makes at least n unread bytes available, compacting the buffer first. False at end of input.
+    bool ensure(size_t n) {
+        while (buf.size() - pos < n && !eof) {
+            if (pos > 0) { buf.erase(0, pos); pos = 0; }
+            size_t old = buf.size();
+            buf.resize(old + CHUNK);
+            size_t got = reader(&buf[old], CHUNK);
+            buf.resize(old + got);
+            if (got == 0) eof = true;
         }
-        else if (c == '=') {
-            if (i + 1 < source.length() && source[i+1] == '=') {
-                tokens.push_back(Token(TOK_EE, "==", start_line, start_col)); i+=2; current_column+=2;
-            } else {
-                tokens.push_back(Token(TOK_EQUALS, "=", start_line, start_col)); i++; current_column++;
+        return buf.size() - pos >= n;
+    }
+    char peekAt(size_t k) { return ensure(k + 1) ? buf[pos + k] : '\0'; }
+    static bool isIdentChar(char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+    static bool isNumberChar(char c) { return isdigit(static_cast<unsigned char>(c)) || c == '.'; }
+    // Length of the run of bytes at the cursor satisfying pred.
+    template <typename Pred> size_t scanRun(Pred pred) {
+        size_t len = 0;
+        while (ensure(len + 1) && pred(buf[pos + len])) len++;
+        return len;
+    }
+    Token single(TokenKind kind, const char* text, int line, int col, size_t width = 1) {
+        pos += width;
+        current_column += (int)width;
+        return Token(kind, text, line, col);
+    }
+    Token stringLiteral(int start_line, int start_col) {
+        pos++; current_column++;
+        std::string s;
+        while (true) {
+            size_t run = scanRun([](char ch) { return ch != '"' && ch != '\\'; });
+            for (size_t k = 0; k < run; ++k) {
+                if (buf[pos + k] == '\n') { current_line++; current_column = 1; }
+                else current_column++;
             }
+            s.append(buf, pos, run);
+            pos += run;
+            if (!ensure(1)) throw_lexer_error("Unclosed string literal.");
+            if (buf[pos] == '"') { pos++; current_column++; break; }
+            pos++; current_column++;
+            if (!ensure(1)) throw_lexer_error("Invalid escape sequence in string literal.");
+            char esc = buf[pos];
+            if (esc == 'n') s += '\n';
+            else if (esc == 't') s += '\t';
+            else if (esc == 'r') s += '\r';
+            else if (esc == '"' || esc == '\\') s += esc;
+            else { s += '\\'; s += esc; } // unknown escapes stay literal, so regex patterns can write "\d"
+            pos++; current_column++;
         }
-        else if (c == '!') {
-            if (i + 1 < source.length() && source[i+1] == '=') {
-                tokens.push_back(Token(TOK_NE, "!=", start_line, start_col)); i+=2; current_column+=2;
-            } else { i++; current_column++; throw_lexer_error("Unknown operator: '!'"); }
-        }
-        else if (c == '/') {
-            if (i + 1 < source.length() && source[i+1] == '/') {
-                i += 2; current_column += 2;
-                while (i < source.length() && source[i] != '\n') { i++; current_column++; }
+        return Token(TOK_STRING_LIT, s, start_line, start_col);
+    }
+    void skipLine() {
+        while (ensure(1) && buf[pos] != '\n') { pos++; current_column++; }
+    }
+public:
+    Lexer(ChunkReader r, int line = 1, int column = 1) : reader(std::move(r)) {
+        current_line = line;
+        current_column = column;
+    }
+    // Skips the rest of a block whose '{' was just consumed, without tokenising it, and returns its
+    // text up to the matching '}'. Braces inside strings and comments are not counted.
+    std::string skipBlock() {
+        std::string text;
+        int depth = 1;
+        bool inString = false;
+        while (ensure(1)) {
+            char c = buf[pos];
+            if (inString) {
+                if (c == '"') inString = false;
+                else if (c == '\\' && peekAt(1) != '\0') {
+                    text += c;
+                    pos++; current_column++;
+                    c = buf[pos];
+                }
+            } else if (c == '"') {
+                inString = true;
+            } else if ((c == '/' && peekAt(1) == '/') || (c == '-' && peekAt(1) == '>')) {
+                skipLine();
                 continue;
-            } else {
-                tokens.push_back(Token(TOK_SLASH, "/", start_line, start_col)); i++; current_column++;
+            } else if (c == '{') {
+                depth++;
+            } else if (c == '}' && --depth == 0) {
+                pos++; current_column++;
+                return text;
             }
+            if (c == '\n') { current_line++; current_column = 1; }
+            else current_column++;
+            text += c;
+            pos++;
         }
-        else if (c == '-') {
-            if (i + 1 < source.length() && source[i+1] == '>') {
-                i += 2; current_column += 2;
-                while (i < source.length() && source[i] != '\n') { i++; current_column++; }
-                continue;
-            } else {
-                tokens.push_back(Token(TOK_MINUS, "-", start_line, start_col)); i++; current_column++;
+        throw_lexer_error("Unclosed block.");
+        return text;
+    }
+    Token next() {
+        while (ensure(1)) {
+            char c = buf[pos];
+            if (c == '\n') { pos++; current_line++; current_column = 1; continue; }
+            if (c == '\r') { pos++; current_column++; continue; }
+            if (isspace(static_cast<unsigned char>(c))) { pos++; current_column++; continue; }
+            int start_line = current_line;
+            int start_col = current_column;
+            if (c == '"') return stringLiteral(start_line, start_col);
+            if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                size_t len = scanRun(isIdentChar);
+                std::string id(buf, pos, len);
+                pos += len;
+                current_column += (int)len;
+                return Token(check_keyword(id), id, start_line, start_col);
+            }
+            if (isdigit(static_cast<unsigned char>(c))) {
+                size_t len = scanRun(isNumberChar);
+                std::string num(buf, pos, len);
+                pos += len;
+                current_column += (int)len;
+                return Token(TOK_NUMBER, num, start_line, start_col);
+            }
+            switch (c) {
+                case '=':
+                    if (peekAt(1) == '=') return single(TOK_EE, "==", start_line, start_col, 2);
+                    return single(TOK_EQUALS, "=", start_line, start_col);
+                case '!':
+                    if (peekAt(1) == '=') return single(TOK_NE, "!=", start_line, start_col, 2);
+                    pos++; current_column++;
+                    throw_lexer_error("Unknown operator: '!'");
+                    break;
+                case '/':
+                    if (peekAt(1) == '/') { skipLine(); continue; }
+                    return single(TOK_SLASH, "/", start_line, start_col);
+                case '-':
+                    if (peekAt(1) == '>') { skipLine(); continue; }
+                    return single(TOK_MINUS, "-", start_line, start_col);
+                case '@': return single(TOK_AT, "@", start_line, start_col);
+                case ';': return single(TOK_SEMICOLON, ";", start_line, start_col);
+                case '.': return single(TOK_DOT, ".", start_line, start_col);
+                case '(': return single(TOK_LPAREN, "(", start_line, start_col);
+                case ')': return single(TOK_RPAREN, ")", start_line, start_col);
+                case '{': return single(TOK_LBRACE, "{", start_line, start_col);
+                case '}': return single(TOK_RBRACE, "}", start_line, start_col);
+                case '[': return single(TOK_LBRACKET, "[", start_line, start_col);
+                case ']': return single(TOK_RBRACKET, "]", start_line, start_col);
+                case ',': return single(TOK_COMMA, ",", start_line, start_col);
+                case '+': return single(TOK_PLUS, "+", start_line, start_col);
+                case '*': return single(TOK_STAR, "*", start_line, start_col);
+                case '%': return single(TOK_PERCENT, "%", start_line, start_col);
+                case '<':
+                    if (peekAt(1) == '<') return single(TOK_SHL, "<<", start_line, start_col, 2);
+                    return single(TOK_LT, "<", start_line, start_col);
+                case '>':
+                    if (peekAt(1) == '>') return single(TOK_SHR, ">>", start_line, start_col, 2);
+                    return single(TOK_GT, ">", start_line, start_col);
+                case '&': return single(TOK_AMP, "&", start_line, start_col);
+                case '|': return single(TOK_PIPE, "|", start_line, start_col);
+                case '^': return single(TOK_CARET, "^", start_line, start_col);
+                default:
+                    pos++; current_column++;
+                    throw_lexer_error("Unknown character");
             }
         }
-        else if (c == ';') { tokens.push_back(Token(TOK_SEMICOLON, ";", start_line, start_col)); i++; current_column++; }
-        else if (c == '.') { tokens.push_back(Token(TOK_DOT, ".", start_line, start_col)); i++; current_column++; }
-        else if (c == '(') { tokens.push_back(Token(TOK_LPAREN, "(", start_line, start_col)); i++; current_column++; }
-        else if (c == ')') { tokens.push_back(Token(TOK_RPAREN, ")", start_line, start_col)); i++; current_column++; }
-        else if (c == '{') { tokens.push_back(Token(TOK_LBRACE, "{", start_line, start_col)); i++; current_column++; }
-        else if (c == '}') { tokens.push_back(Token(TOK_RBRACE, "}", start_line, start_col)); i++; current_column++; }
-        else if (c == '[') { tokens.push_back(Token(TOK_LBRACKET, "[", start_line, start_col)); i++; current_column++; }
-        else if (c == ']') { tokens.push_back(Token(TOK_RBRACKET, "]", start_line, start_col)); i++; current_column++; }
-        else if (c == ',') { tokens.push_back(Token(TOK_COMMA, ",", start_line, start_col)); i++; current_column++; }
-        else if (c == '+') { tokens.push_back(Token(TOK_PLUS, "+", start_line, start_col)); i++; current_column++; }
-        else if (c == '*') { tokens.push_back(Token(TOK_STAR, "*", start_line, start_col)); i++; current_column++; }
-        else if (c == '%') { tokens.push_back(Token(TOK_PERCENT, "%", start_line, start_col)); i++; current_column++; }
-        else if (c == '<') { tokens.push_back(Token(TOK_LT, "<", start_line, start_col)); i++; current_column++; }
-        else if (c == '>') { tokens.push_back(Token(TOK_GT, ">", start_line, start_col)); i++; current_column++; }
-        else { i++; current_column++; throw_lexer_error("Unknown character"); }
-    }
-    tokens.push_back(Token(TOK_EOF, "", current_line, current_column));
-    return tokens;
-}
+        return Token(TOK_EOF, "", current_line, current_column);
+    }
+};
 
 class Interpreter;
 class ULangObject;
 class ASTNode;
 class InstanceObject;
+// ULang values currently alive, reported as the heap-object counter by --stats and --trace.
+static std::atomic<long long> live_objects{0};
 class ULangObject : public std::enable_shared_from_this<ULangObject> {
 public:
-    enum Type { NUMBER, STRING, BOOLEAN, FUNCTION, VAL_VOID, CLASS, INSTANCE, LIST, BUILTIN };
+    enum Type { NUMBER, STRING, BOOLEAN, FUNCTION, VAL_VOID, CLASS, INSTANCE, LIST, BUILTIN, TASK, MODULE, BYTES, ERROR, TABLE };
     Type type;
-    ULangObject(Type t) : type(t) {}
-    virtual ~ULangObject() = default;
+    ULangObject(Type t) : type(t) { if (object_counting) live_objects.fetch_add(1, std::memory_order_relaxed); }
+    ULangObject(const ULangObject& other) : std::enable_shared_from_this<ULangObject>(), type(other.type) {
+        if (object_counting) live_objects.fetch_add(1, std::memory_order_relaxed);
+    }
+    virtual ~ULangObject() { if (object_counting) live_objects.fetch_sub(1, std::memory_order_relaxed); }
     virtual std::string toString() const = 0;
+    // Appends the printed form to out; output, list printing and concatenation build into one buffer this way.
+    virtual void appendTo(std::string& out) const { out += toString(); }
     virtual double toDouble() const { return 0.0; }
     virtual bool isTruthy() const { return type != VAL_VOID && type != BOOLEAN ? true : (type == BOOLEAN ? toDouble() : false); }
     virtual std::shared_ptr<ULangObject> getMethod(const std::string& name) { return nullptr; }
 };
+// A view of call arguments living on the interpreter's value stack (or in any vector).
+// It is only valid until the callee evaluates further code; copy out anything kept longer.
+struct ArgList {
+    const std::shared_ptr<ULangObject>* first;
+    size_t count;
+    ArgList(const std::shared_ptr<ULangObject>* f, size_t n) : first(f), count(n) {}
+    ArgList(const std::vector<std::shared_ptr<ULangObject>>& v) : first(v.data()), count(v.size()) {}
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const std::shared_ptr<ULangObject>& operator[](size_t i) const { return first[i]; }
+    const std::shared_ptr<ULangObject>* begin() const { return first; }
+    const std::shared_ptr<ULangObject>* end() const { return first + count; }
+};
 class VoidObject : public ULangObject {
 public:
     VoidObject() : ULangObject(VAL_VOID) {}
@@ -228,68 +450,223 @@ public:
     bool isTruthy() const override { return false; }
 };
 static std::shared_ptr<ULangObject> VOID_INSTANCE = std::make_shared<VoidObject>();
+// Numbers are either exact 64-bit integers (isInt) or doubles. value always mirrors the number as a
+// double so code that only needs a double keeps working; integer-aware paths read ivalue instead.
 class NumberObject : public ULangObject {
 public:
     double value;
+    int64_t ivalue = 0;
+    bool isInt = false;
     NumberObject(double v) : ULangObject(NUMBER), value(v) {}
+    static std::shared_ptr<NumberObject> integer(int64_t v) {
+        auto n = std::make_shared<NumberObject>((double)v);
+        n->ivalue = v;
+        n->isInt = true;
+        return n;
+    }
+    // Exact integer value of an int, or of a double with no fractional part that fits in int64.
+    bool asInteger(int64_t& out) const {
+        if (isInt) { out = ivalue; return true; }
+        if (std::floor(value) != value || value < -9223372036854775808.0 || value >= 9223372036854775808.0) return false;
+        out = (int64_t)value;
+        return true;
+    }
+    // Shortest text that parses back to the same double (0.1 prints as 0.1), with no locale or stream state.
+    // Like the stream formatting it replaced, notation is fixed unless the exponent is below -4 or above 16.
+    void appendTo(std::string& out) const override {
+        char digits[64];
+        if (isInt) {
+            out.append(digits, std::to_chars(digits, digits + sizeof(digits), ivalue).ptr);
+            return;
+        }
+        auto res = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::scientific);
+        if (std::isfinite(value)) {
+            const char* e = std::find(digits, res.ptr, 'e');
+            int exponent = 0;
+            std::from_chars(e + (e[1] == '+' ? 2 : 1), res.ptr, exponent);
+            if (exponent >= -4 && exponent <= 16) res = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed);
+        }
+        out.append(digits, res.ptr);
+    }
     std::string toString() const override {
-        std::stringstream ss;
-        ss << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
-        return ss.str();
+        std::string s;
+        appendTo(s);
+        return s;
     }
     double toDouble() const override { return value; }
     bool isTruthy() const override { return value != 0.0; }
 };
+// Immutable text. A string either owns its bytes or is a slice viewing part of another string's:
+// slicing is O(1) and shares the buffer, which the slice keeps alive by holding the owning string.
 class StringObject : public ULangObject {
+    std::string owned;
+    std::shared_ptr<const StringObject> root;
+    const char* ptr;
+    size_t len;
+public:
+    StringObject(const std::string& v) : ULangObject(STRING), owned(v), ptr(owned.data()), len(owned.size()) {}
+    // Takes over the buffer, so a response or file read into a std::string is never copied.
+    StringObject(std::string&& v) : ULangObject(STRING), owned(std::move(v)), ptr(owned.data()), len(owned.size()) {}
+    StringObject(std::shared_ptr<const StringObject> r, const char* p, size_t n) : ULangObject(STRING), root(std::move(r)), ptr(p), len(n) {}
+    StringObject(const StringObject&) = delete;
+    std::string_view view() const { return std::string_view(ptr, len); }
+    std::string str() const { return std::string(ptr, len); }
+    size_t size() const { return len; }
+    static std::shared_ptr<StringObject> slice(const std::shared_ptr<StringObject>& s, size_t start, size_t n) {
+        return std::make_shared<StringObject>(s->root ? s->root : s, s->ptr + start, n);
+    }
+    std::string toString() const override { return str(); }
+    void appendTo(std::string& out) const override { out.append(ptr, len); }
+    bool isTruthy() const override { return len != 0; }
+    std::shared_ptr<ULangObject> getMethod(const std::string& name) override;
+};
+// Mutable binary data. http_*, file and hashing builtins read it in place, and buffers they fill
+// are moved in rather than copied.
+class BytesObject : public ULangObject {
 public:
-    std::string value;
-    StringObject(const std::string& v) : ULangObject(STRING), value(v) {}
-    std::string toString() const override { return value; }
-    bool isTruthy() const override { return !value.empty(); }
+    std::string data;
+    BytesObject(std::string d) : ULangObject(BYTES), data(std::move(d)) {}
+    std::string toString() const override { return "<bytes " + std::to_string(data.size()) + ">"; }
+    bool isTruthy() const override { return !data.empty(); }
+    std::shared_ptr<ULangObject> getMethod(const std::string& name) override;
 };
+// The bytes of a string or Bytes value, without copying; false for other values.
+bool bytesOf(const std::shared_ptr<ULangObject>& value, std::string_view& out) {
+    if (value->type == ULangObject::STRING) { out = static_cast<StringObject*>(value.get())->view(); return true; }
+    if (value->type == ULangObject::BYTES) { out = static_cast<BytesObject*>(value.get())->data; return true; }
+    return false;
+}
 class BooleanObject : public ULangObject {
 public:
     bool value;
     BooleanObject(bool v) : ULangObject(BOOLEAN), value(v) {}
     std::string toString() const override { return value ? "true" : "false"; }
+    void appendTo(std::string& out) const override { out += value ? "true" : "false"; }
     double toDouble() const override { return value ? 1.0 : 0.0; }
     bool isTruthy() const override { return value; }
 };
+// A memo cache size as given by @memo(n) or memo(fn, n); 0 when it is not a whole number from 1 to 2^32.
+size_t memoCapacityOf(double size) {
+    if (!(size >= 1 && size <= 4294967296.0) || size != std::floor(size)) return 0;
+    return (size_t)size;
+}
+// Bounded LRU cache of a memoised function's results, keyed on the argument values.
+// Only numbers, strings, booleans and null are hashable; calls with other arguments bypass the cache.
+class MemoCache {
+public:
+    struct Entry {
+        uint64_t hash;
+        std::vector<std::shared_ptr<ULangObject>> args;
+        std::shared_ptr<ULangObject> result;
+    };
+    std::string name;
+    size_t capacity;
+    unsigned long long hits = 0, misses = 0, evictions = 0, bypassed = 0;
+    std::list<Entry> lru;
+    std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index;
+    MemoCache(const std::string& n, size_t cap) : name(n), capacity(cap ? cap : 1) {}
+    static bool hashArgs(const ArgList& args, uint64_t& out);
+    static bool sameValue(const std::shared_ptr<ULangObject>& a, const std::shared_ptr<ULangObject>& b);
+    std::shared_ptr<ULangObject> find(uint64_t hash, const ArgList& args) {
+        auto range = index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            auto& entry = *it->second;
+            if (entry.args.size() != args.size()) continue;
+            bool same = true;
+            for (size_t i = 0; i < args.size() && same; ++i) same = sameValue(entry.args[i], args[i]);
+            if (!same) continue;
+            lru.splice(lru.begin(), lru, it->second);
+            return entry.result;
+        }
+        return nullptr;
+    }
+    void insert(uint64_t hash, std::vector<std::shared_ptr<ULangObject>> args, std::shared_ptr<ULangObject> result) {
+        if (lru.size() >= capacity) {
+            auto victim = std::prev(lru.end());
+            auto range = index.equal_range(victim->hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == victim) { index.erase(it); break; }
+            }
+            lru.pop_back();
+            evictions++;
+        }
+        lru.push_front(Entry{hash, std::move(args), std::move(result)});
+        index.emplace(hash, lru.begin());
+    }
+};
+class ModuleObject;
+// A module's function body kept as source until the first call; see Parser::lazyBodies.
+struct LazyBody {
+    std::string source;
+    int line, column;
+    bool parsed = false;
+    std::vector<std::shared_ptr<ASTNode>> statements;
+    LazyBody(std::string s, int l, int c) : source(std::move(s)), line(l), column(c) {}
+    const std::vector<std::shared_ptr<ASTNode>>& parse(Interpreter& interpreter);
+};
 class FunctionObject : public ULangObject {
 public:
     std::vector<std::string> params;
     std::vector<std::shared_ptr<ASTNode>> body;
     std::shared_ptr<InstanceObject> receiver;
+    std::string name;
+    std::shared_ptr<MemoCache> memo;
+    // Declared `async`: calling it starts a task instead of running the body.
+    bool isAsync = false;
+    // Module whose globals the body sees; null runs it in the caller's.
+    ModuleObject* module = nullptr;
+    // Set until the body is parsed.
+    std::shared_ptr<LazyBody> lazy;
     FunctionObject(const std::vector<std::string>& p, const std::vector<std::shared_ptr<ASTNode>>& b, std::shared_ptr<InstanceObject> r = nullptr)
         : ULangObject(FUNCTION), params(p), body(b), receiver(r) {}
     std::string toString() const override { return "<function>"; }
+    void ensureParsed(Interpreter& interpreter) {
+        if (!lazy) return;
+        body = lazy->parse(interpreter);
+        lazy = nullptr;
+    }
     std::shared_ptr<FunctionObject> bind(std::shared_ptr<InstanceObject> instance) {
-        return std::make_shared<FunctionObject>(params, body, instance);
+        auto bound = std::make_shared<FunctionObject>(params, body, instance);
+        bound->name = name;
+        bound->isAsync = isAsync;
+        bound->module = module;
+        bound->lazy = lazy;
+        return bound;
     }
-    virtual std::shared_ptr<ULangObject> call(Interpreter& interpreter, const std::vector<std::shared_ptr<ULangObject>>& args);
+    virtual std::shared_ptr<ULangObject> call(Interpreter& interpreter, const ArgList& args) { return invoke(interpreter, args, receiver); }
+    // Runs the body with `self` as `this`; method calls pass the instance here instead of bind()ing.
+    std::shared_ptr<ULangObject> invoke(Interpreter& interpreter, const ArgList& args, const std::shared_ptr<InstanceObject>& self);
+    // The call itself; for an async function this is what its task runs.
+    std::shared_ptr<ULangObject> execute(Interpreter& interpreter, const ArgList& args, const std::shared_ptr<InstanceObject>& self);
 };
 class BuiltinFunction : public ULangObject {
 public:
-    using FuncType = std::function<std::shared_ptr<ULangObject>(Interpreter&, const std::vector<std::shared_ptr<ULangObject>>&)> ;
+    using FuncType = std::function<std::shared_ptr<ULangObject>(Interpreter&, const ArgList&)> ;
     FuncType func;
     std::string name;
     BuiltinFunction(const std::string& n, FuncType f) : ULangObject(BUILTIN), name(n), func(f) {}
     std::string toString() const override { return "<builtin " + name + ">"; }
-    std::shared_ptr<ULangObject> call(Interpreter& interpreter, const std::vector<std::shared_ptr<ULangObject>>& args) { return func(interpreter, args); }
+    std::shared_ptr<ULangObject> call(Interpreter& interpreter, const ArgList& args) { return func(interpreter, args); }
 };
 class ListObject : public ULangObject {
 public:
     std::vector<std::shared_ptr<ULangObject>> elements;
     ListObject(const std::vector<std::shared_ptr<ULangObject>>& e) : ULangObject(LIST), elements(e) {}
-    std::string toString() const override {
-        std::string s = "[";
+    void appendTo(std::string& out) const override {
+        out += '[';
         for (size_t i = 0; i < elements.size(); ++i) {
-            s += elements[i]->toString();
-            if (i < elements.size() - 1) s += ", ";
+            if (i > 0) out += ", ";
+            elements[i]->appendTo(out);
         }
-        return s + "]";
+        out += ']';
+    }
+    std::string toString() const override {
+        std::string s;
+        appendTo(s);
+        return s;
     }
     std::shared_ptr<ULangObject> getMethod(const std::string& name) override;
+    std::shared_ptr<ULangObject> callMethod(const std::string& name, const ArgList& args);
 };
 class ClassObject : public ULangObject {
 public:
@@ -317,55 +694,516 @@ public:
         fields[name] = value;
     }
 };
+// A loaded module: its own global scope. Builtins are shared by all modules and resolved after it.
+class ModuleObject : public ULangObject {
+public:
+    std::string name;
+    std::string path;
+    std::unordered_map<std::string, std::shared_ptr<ULangObject>> globals;
+    ModuleObject(const std::string& n, const std::string& p) : ULangObject(MODULE), name(n), path(p) {}
+    std::string toString() const override { return "<module " + name + ">"; }
+};
+// What a catch block receives: the error's type, message and source position as fields.
+// Printing it gives the message alone; the "ERROR [type] Line ..." form is only built for uncaught errors.
+class ErrorObject : public ULangObject {
+public:
+    std::string errorType, message;
+    int line, column;
+    ErrorObject(std::string t, std::string m, int l, int c) : ULangObject(ERROR), errorType(std::move(t)), message(std::move(m)), line(l), column(c) {}
+    std::string toString() const override { return message; }
+    void appendTo(std::string& out) const override { out += message; }
+    std::shared_ptr<ULangObject> field(const std::string& name) const;
+};
 class ASTNode {
 public:
+    // Where the statement starting with this node begins; 0 for expressions and synthesised nodes.
+    int line = 0, column = 0;
     virtual ~ASTNode() = default;
     virtual std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) = 0;
+    // One-line label used by --dump-ast.
+    virtual std::string describe() const = 0;
+    // Visits every child slot by reference so optimiser passes can rewrite the tree in place.
+    virtual void children(const std::function<void(std::shared_ptr<ASTNode>&)>&) {}
+};
+// A local scope. Frames are pooled by the interpreter: popping one only clears its bindings,
+// so the vector keeps its capacity and the next call at that depth allocates nothing.
+// Names point at strings owned by the AST or the function's parameter list, which outlive the
+// binding, so binding a parameter never copies its name.
+struct Frame {
+    std::vector<std::pair<const std::string*, std::shared_ptr<ULangObject>>> vars;
+    // Bloom bits of the names bound here or in any frame below; a name whose bit is clear is not
+    // looked for in frames at all, so globals stay cheap to reach from deep recursion.
+    uint64_t visible = 0;
+    static uint64_t bit(const std::string& name) {
+        size_t n = name.size();
+        return n ? 1ull << ((n * 7 + (unsigned char)name[0] * 31 + (unsigned char)name[n - 1]) & 63) : 1;
+    }
+    std::shared_ptr<ULangObject>* find(const std::string& name) {
+        for (auto& v : vars) if (v.first == &name || *v.first == name) return &v.second;
+        return nullptr;
+    }
+};
+// Restores the value stack to its height at construction, including when a callee throws.
+struct ValueStackMark {
+    std::vector<std::shared_ptr<ULangObject>>& stack;
+    size_t base;
+    ValueStackMark(std::vector<std::shared_ptr<ULangObject>>& s) : stack(s), base(s.size()) {}
+    ~ValueStackMark() { stack.resize(base); }
+};
+// A call in tail position is parked here by ReturnNode and run by the enclosing invoke loop.
+// Limits for running untrusted scripts, set through Interpreter::setLimits; 0 means unlimited.
+// Exceeding one raises a catchable ResourceLimitError.
+struct ResourceLimits {
+    uint64_t maxSteps = 0;     // loop iterations plus function calls
+    size_t maxHeapBytes = 0;   // bytes allocated through operator new since setLimits and still live
+    uint64_t timeoutMs = 0;    // wall-clock time from setLimits
+    size_t maxDepth = 10000;   // nested calls, as --max-depth
+};
+struct TailCall {
+    bool pending = false;
+    std::shared_ptr<FunctionObject> fn;
+    std::shared_ptr<InstanceObject> self;
+    std::vector<std::shared_ptr<ULangObject>> args;
+};
+// Everything the interpreter keeps per thread of execution. A suspended task holds its own copy,
+// which the event loop swaps with the interpreter's while the task runs.
+struct ExecutionState {
+    ModuleObject* module = nullptr;
+    std::vector<Frame> frames;
+    size_t depth = 0;
+    std::vector<std::shared_ptr<ULangObject>> valueStack;
+    bool returning = false;
+    std::shared_ptr<ULangObject> returnValue;
+    std::shared_ptr<InstanceObject> current_instance;
+    TailCall tailCall;
+    size_t callDepth = 0;
+    const char* nativeStackBase = nullptr;
+    size_t nativeStackSize = 0;
+};
+// Asynchronous work: a call to an async function, run as a coroutine on a native stack of its own,
+// or a leaf the event loop completes itself (a timer, an HTTP transfer, a gather).
+class TaskObject : public ULangObject {
+public:
+    enum State { PENDING, RUNNING, DONE, FAILED, CANCELLED };
+    State state = PENDING;
+    std::string name;
+    std::shared_ptr<ULangObject> result = VOID_INSTANCE;
+    std::string errorType, errorMessage;
+    // Run once, when the task finishes.
+    std::vector<std::function<void()>> onDone;
+    // Releases whatever a pending leaf waits on (a timer slot, a transfer) when it is cancelled.
+    std::function<void()> onCancel;
+    std::vector<std::shared_ptr<TaskObject>> children;
+    std::shared_ptr<FunctionObject> fn;
+    std::shared_ptr<InstanceObject> self;
+    std::vector<std::shared_ptr<ULangObject>> args;
+    struct Coroutine {
+        ucontext_t context;
+        char* stack = nullptr;
+        size_t stackSize = 0;
+        ExecutionState state;
+        ~Coroutine() { if (stack) munmap(stack, stackSize); }
+    };
+    std::unique_ptr<Coroutine> coroutine;
+    // The task this coroutine is suspended on, if any.
+    TaskObject* awaiting = nullptr;
+    bool queued = false;
+    bool cancelRequested = false;
+    // Track the task's spans are drawn on in a trace; the main program is 1.
+    uint64_t id = 1;
+    TaskObject(const std::string& n) : ULangObject(TASK), name(n) {}
+    bool finished() const { return state >= DONE; }
+    std::string toString() const override {
+        static const char* names[] = {"pending", "running", "done", "failed", "cancelled"};
+        return "<task " + name + " " + names[state] + ">";
+    }
+};
+// Hashed timing wheel with 1 ms slots: adding a timer is O(1) and each tick only looks at one slot.
+// Deadlines more than one revolution away stay in their slot until their round comes up.
+class TimerWheel {
+public:
+    static const size_t SLOTS = 1024;
+    struct Timer {
+        uint64_t deadline;
+        std::shared_ptr<TaskObject> task;
+    };
+    std::vector<std::vector<Timer>> slots = std::vector<std::vector<Timer>>(SLOTS);
+    // Next millisecond not yet processed.
+    uint64_t tick = 0;
+    size_t count = 0;
+    // Returns the deadline the timer was filed under, which remove() needs: one already past is
+    // filed at the next tick, since advance() has left its own slot behind.
+    uint64_t add(uint64_t deadline, std::shared_ptr<TaskObject> task) {
+        deadline = std::max(deadline, tick);
+        slots[deadline % SLOTS].push_back(Timer{deadline, std::move(task)});
+        count++;
+        return deadline;
+    }
+    void remove(uint64_t deadline, const TaskObject* task) {
+        auto& slot = slots[deadline % SLOTS];
+        for (size_t i = 0; i < slot.size(); ++i) {
+            if (slot[i].task.get() != task) continue;
+            slot[i] = std::move(slot.back());
+            slot.pop_back();
+            count--;
+            return;
+        }
+    }
+    // Moves every timer due at or before now into due, earliest tick first.
+    void advance(uint64_t now, std::vector<std::shared_ptr<TaskObject>>& due) {
+        uint64_t end = now + 1;
+        if (count == 0) { tick = std::max(tick, end); return; }
+        // Idle for more than a revolution: one pass over every slot is enough.
+        if (tick + SLOTS < end) tick = end - SLOTS;
+        for (; tick < end; ++tick) {
+            auto& slot = slots[tick % SLOTS];
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].deadline > now) { ++i; continue; }
+                due.push_back(std::move(slot[i].task));
+                slot[i] = std::move(slot.back());
+                slot.pop_back();
+                count--;
+            }
+        }
+    }
+    // Milliseconds until the earliest deadline, or -1 when no timer is pending.
+    long nextTimeout(uint64_t now) const {
+        if (count == 0) return -1;
+        uint64_t earliest = UINT64_MAX;
+        for (auto& slot : slots) for (auto& t : slot) earliest = std::min(earliest, t.deadline);
+        return earliest <= now ? 0 : (long)std::min<uint64_t>(earliest - now, 60000);
+    }
+};
+// Runs tasks one at a time on the interpreter thread. Coroutines switch with swapcontext, HTTP
+// transfers are driven by one curl multi handle and sleeps by the timer wheel. The loop itself only
+// runs while the main program awaits (or after it ends); a task that awaits switches back to it.
+class EventLoop {
+public:
+    Interpreter& interpreter;
+    // Task whose coroutine is running, or null while the main program runs.
+    TaskObject* current = nullptr;
+    uint64_t spawned = 0;
+    static const size_t TASK_STACK_SIZE = 8 * 1024 * 1024;
+    EventLoop(Interpreter& i) : interpreter(i) {}
+    ~EventLoop();
+    std::shared_ptr<TaskObject> spawn(const std::shared_ptr<FunctionObject>& fn, const std::shared_ptr<InstanceObject>& self, const ArgList& args);
+    std::shared_ptr<TaskObject> sleep(int64_t ms);
+    // A GET, or a POST when body is given; the task's result is the response body.
+    std::shared_ptr<TaskObject> http(const std::string& url, const std::shared_ptr<ULangObject>& body, const std::vector<std::string>& headers);
+    // Finishes with the list of results once every task has, or with the first failure.
+    std::shared_ptr<TaskObject> gather(const std::vector<std::shared_ptr<TaskObject>>& tasks);
+    bool cancel(const std::shared_ptr<TaskObject>& task);
+    std::shared_ptr<ULangObject> await(const std::shared_ptr<TaskObject>& task);
+    // Runs until the task finishes, or with no task until no work is left.
+    void run(TaskObject* until = nullptr);
+private:
+    struct Transfer {
+        std::shared_ptr<TaskObject> task;
+        std::string url;
+        uint64_t id = 0, startUs = 0;
+        // Kept alive for the transfer, which sends straight from its buffer.
+        std::shared_ptr<ULangObject> body;
+        // A bytes body is copied: other tasks may append to it, moving its buffer, while the transfer runs.
+        std::string bodyCopy;
+        std::string response;
+        curl_slist* headers = nullptr;
+    };
+    std::deque<std::shared_ptr<TaskObject>> ready;
+    TimerWheel timers;
+    CURLM* multi = nullptr;
+    std::unordered_map<CURL*, std::unique_ptr<Transfer>> transfers;
+    uint64_t transferCount = 0;
+    ucontext_t loopContext;
+    static EventLoop* active;
+    static uint64_t nowMs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static void entry();
+    void schedule(const std::shared_ptr<TaskObject>& task);
+    void whenDone(TaskObject& task, std::function<void()> callback);
+    void finish(TaskObject& task);
+    void fail(TaskObject& task, const std::string& type, const std::string& message);
+    void resume(const std::shared_ptr<TaskObject>& task);
+    std::unique_ptr<Transfer> endTransfer(CURL* handle);
+    void pollTransfers(long timeoutMs);
+};
+static void appendJsonString(std::string& out, const std::string& s) {
+    out += '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+        else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else out += (char)c;
+    }
+    out += '"';
+}
+// Totals for --stats and events for --trace. Events use the Chrome trace-event JSON format that
+// chrome://tracing and Perfetto load; timestamps are microseconds since the interpreter started.
+class Tracer {
+public:
+    bool stats = false;
+    bool tracing = false;
+    // Calls shorter than this are counted but get no span of their own.
+    uint64_t thresholdUs = 100;
+    uint64_t parseUs = 0, executeUs = 0, calls = 0;
+    uint64_t httpRequests = 0, httpBlockedUs = 0, httpInFlightUs = 0;
+    uint64_t modulesLoaded = 0, modulesCompiled = 0, lazyBodiesParsed = 0;
+    long long peakObjects = 0;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    bool active() const { return stats || tracing; }
+    uint64_t nowUs() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+    // A span from startUs to now.
+    void span(const std::string& name, const char* category, uint64_t startUs, uint64_t tid = 1) {
+        if (!tracing) return;
+        uint64_t end = nowUs();
+        event('X', name, category, startUs, tid);
+        events += ",\"dur\":";
+        events += std::to_string(end - startUs);
+        events += '}';
+    }
+    // Begin ('b') or end ('e') of a span that may overlap others on its track, such as an async request.
+    void asyncSpan(char phase, const std::string& name, const char* category, uint64_t id, uint64_t ts) {
+        if (!tracing) return;
+        event(phase, name, category, ts, 1);
+        events += ",\"id\":";
+        events += std::to_string(id);
+        events += '}';
+    }
+    // A blocking request made by http_get or http_post.
+    void blockingHttp(const std::string& name, uint64_t startUs) {
+        httpRequests++;
+        httpBlockedUs += nowUs() - startUs;
+        span(name, "http", startUs);
+    }
+    void threadName(uint64_t tid, const std::string& name) {
+        if (!tracing) return;
+        event('M', "thread_name", "__metadata", 0, tid);
+        events += ",\"args\":{\"name\":";
+        appendJsonString(events, name);
+        events += "}}";
+    }
+    void call(const std::string& name, uint64_t startUs, size_t envDepth, uint64_t tid) {
+        calls++;
+        if (tracing && nowUs() - startUs >= thresholdUs) span(name.empty() ? "<function>" : name, "call", startUs, tid);
+        sample(envDepth);
+    }
+    // Heap objects, environment depth and allocations, recorded at most once a millisecond unless forced.
+    void sample(size_t envDepth, bool force = false) {
+        long long live = live_objects.load(std::memory_order_relaxed);
+        peakObjects = std::max(peakObjects, live);
+        if (!tracing) return;
+        uint64_t now = nowUs();
+        if (!force && now < lastSampleUs + 1000) return;
+        lastSampleUs = now;
+        counter("heap objects", now, live);
+        counter("env depth", now, (long long)envDepth);
+        counter("allocations", now, (long long)heap_allocations);
+    }
+    bool writeTrace(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << events << "]}\n";
+        return (bool)out;
+    }
+    void printStats(std::ostream& out, const std::vector<std::shared_ptr<MemoCache>>& memoCaches) const {
+        out << std::fixed << std::setprecision(3);
+        out << "--- ulang stats ---\n";
+        out << "parse:         " << parseUs / 1000.0 << " ms\n";
+        out << "execute:       " << executeUs / 1000.0 << " ms\n";
+        out << "calls:         " << calls << "\n";
+        out << "errors thrown: " << errors_thrown.load() << "\n";
+        out << "allocations:   " << heap_allocations << "\n";
+        out << "heap objects:  " << live_objects.load() << " live, " << peakObjects << " peak\n";
+        out << "http:          " << httpRequests << " requests, " << httpBlockedUs / 1000.0 << " ms blocking, "
+            << httpInFlightUs / 1000.0 << " ms in flight (async)\n";
+        out << "modules:       " << modulesLoaded << " loaded, " << modulesCompiled << " compiled, "
+            << lazyBodiesParsed << " function bodies parsed on first call\n";
+        for (auto& cache : memoCaches) {
+            out << "memo " << cache->name << ": " << cache->hits << " hits, " << cache->misses << " misses, "
+                << cache->evictions << " evictions\n";
+        }
+        out << std::defaultfloat;
+    }
+private:
+    std::string events;
+    uint64_t lastSampleUs = 0;
+    // Opens an event object; the caller appends its remaining fields and the closing brace.
+    void event(char phase, const std::string& name, const char* category, uint64_t ts, uint64_t tid) {
+        if (!events.empty()) events += ",\n";
+        events += "{\"name\":";
+        appendJsonString(events, name);
+        events += ",\"cat\":\"";
+        events += category;
+        events += "\",\"ph\":\"";
+        events += phase;
+        events += "\",\"ts\":";
+        events += std::to_string(ts);
+        events += ",\"pid\":";
+        events += std::to_string(getpid());
+        events += ",\"tid\":";
+        events += std::to_string(tid);
+    }
+    void counter(const char* name, uint64_t ts, long long value) {
+        event('C', name, "counter", ts, 1);
+        events += ",\"args\":{\"value\":";
+        events += std::to_string(value);
+        events += "}}";
+    }
 };
 class Interpreter {
 public:
-    std::map<std::string, std::shared_ptr<ULangObject>> globals;
-    std::map<std::string, std::shared_ptr<ULangObject>>* current_env;
-    std::vector<std::map<std::string, std::shared_ptr<ULangObject>>> env_stack;
+    // Globals of the running code's module. Names not found there fall back to the builtins.
+    ModuleObject* module = nullptr;
+    std::shared_ptr<ModuleObject> builtins = std::make_shared<ModuleObject>("builtins", "");
+    std::shared_ptr<ModuleObject> mainModule = std::make_shared<ModuleObject>("__main__", "");
+    // Every module imported so far, by resolved path; each is loaded once per interpreter.
+    std::unordered_map<std::string, std::shared_ptr<ModuleObject>> modules;
+    // Directories searched for imports after the importing module's own directory.
+    std::vector<std::string> searchPath;
+    std::vector<Frame> frames;
+    size_t depth = 0;
+    // Call arguments are evaluated straight onto this stack and handed to the callee as an ArgList.
+    std::vector<std::shared_ptr<ULangObject>> valueStack;
+    bool returning = false;
+    std::shared_ptr<ULangObject> returnValue;
     std::shared_ptr<InstanceObject> current_instance = nullptr;
+    TailCall tailCall;
+    size_t callDepth = 0;
+    size_t maxCallDepth = 10000;
+    // Bounds of the native stack the interpreter runs on; when known, calls also stop short of overflowing it.
+    const char* nativeStackBase = nullptr;
+    size_t nativeStackSize = 0;
+    // Reused by output() so printing a line does not allocate once the buffer has grown.
+    std::string outputBuffer;
+    // Set when stdout is a terminal; otherwise output is left to the stream buffer.
+    bool flushEachLine = isatty(STDOUT_FILENO);
+    // Every memo cache created by this interpreter, so the profiler can report hit rates.
+    std::vector<std::shared_ptr<MemoCache>> memoCaches;
+    // Declared before the loop, which still reports transfers it aborts while being destroyed.
+    Tracer tracer;
+    EventLoop loop{*this};
     Interpreter() {
-        env_stack.push_back(std::map<std::string, std::shared_ptr<ULangObject>>());
-        current_env = &env_stack.back();
+        valueStack.reserve(256);
+        module = builtins.get();
         loadLibs();
+        module = mainModule.get();
+    }
+    ~Interpreter() {
+        if (heap_trip == &nextCheck) heap_trip = nullptr;
     }
     void define(const std::string& name, std::shared_ptr<ULangObject> val) {
-        (*current_env)[name] = val;
+        if (depth == 0) { module->globals[name] = val; return; }
+        Frame& frame = frames[depth - 1];
+        if (auto slot = frame.find(name)) *slot = val;
+        else {
+            frame.vars.emplace_back(&name, std::move(val));
+            frame.visible |= Frame::bit(name);
+        }
     }
-    void assign(const std::string& name, std::shared_ptr<ULangObject> val) {
-        for (auto it = env_stack.rbegin(); it != env_stack.rend(); ++it) {
-            if (it->count(name)) {
-                (*it)[name] = val;
-                return;
-            }
+    std::shared_ptr<ULangObject>* resolve(const std::string& name) {
+        // Scoping is dynamic: a function sees its callers' variables, innermost first.
+        if (depth > 0 && (frames[depth - 1].visible & Frame::bit(name))) for (size_t d = depth; d > 0; --d) {
+            if (auto slot = frames[d - 1].find(name)) return slot;
         }
-        throw_runtime_error("Undefined variable '" + name + "'.");
+        auto it = module->globals.find(name);
+        if (it != module->globals.end()) return &it->second;
+        it = builtins->globals.find(name);
+        return it != builtins->globals.end() ? &it->second : nullptr;
+    }
+    // False when the name is not defined anywhere; callers decide whether that defines it or is an error.
+    bool assign(const std::string& name, std::shared_ptr<ULangObject> val) {
+        auto slot = resolve(name);
+        if (slot) *slot = std::move(val);
+        return slot != nullptr;
     }
     std::shared_ptr<ULangObject> lookup(const std::string& name) {
-        for (auto it = env_stack.rbegin(); it != env_stack.rend(); ++it) {
-            if (it->count(name)) return (*it)[name];
-        }
+        if (auto slot = resolve(name)) return *slot;
         throw_runtime_error("Undefined variable '" + name + "'.");
         return VOID_INSTANCE;
     }
+    void enterCall() {
+        char probe;
+        bool nativeExhausted = nativeStackBase && (size_t)(nativeStackBase - &probe) + 256 * 1024 > nativeStackSize;
+        if (callDepth >= maxCallDepth || nativeExhausted) {
+            throw ULangError("Maximum recursion depth (" + std::to_string(maxCallDepth) + ") exceeded", "RecursionError", current_line, current_column);
+        }
+        callDepth++;
+    }
+    void exitCall() { callDepth--; }
+    ResourceLimits limits;
+    // Loop back-edges and calls so far. Limits are only looked at when steps reaches nextCheck, so the
+    // per-step cost is one increment and compare; with no limits set nextCheck is never reached.
+    uint64_t steps = 0;
+    uint64_t nextCheck = UINT64_MAX;
+    std::chrono::steady_clock::time_point deadline;
+    static constexpr uint64_t limitCheckInterval = 1024;
+    void setLimits(const ResourceLimits& l) {
+        limits = l;
+        maxCallDepth = l.maxDepth;
+        steps = 0;
+        heap_bytes = 0;
+        heap_accounting = l.maxHeapBytes > 0;
+        heap_limit = (long long)l.maxHeapBytes;
+        heap_trip = heap_accounting ? &nextCheck : nullptr;
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(l.timeoutMs);
+        scheduleLimitCheck();
+    }
+    void scheduleLimitCheck() {
+        if (limits.timeoutMs) nextCheck = steps + limitCheckInterval;
+        else nextCheck = UINT64_MAX;
+        if (limits.maxSteps) nextCheck = std::min(nextCheck, limits.maxSteps + 1);
+    }
+    void step() { if (++steps >= nextCheck) checkLimits(); }
+    __attribute__((cold, noinline)) void checkLimits() {
+        if (limits.maxSteps && steps > limits.maxSteps)
+            throw ULangError("Step limit (" + std::to_string(limits.maxSteps) + ") exceeded", "ResourceLimitError", current_line, current_column);
+        if (limits.maxHeapBytes && heap_bytes > (long long)limits.maxHeapBytes) throw_heap_limit();
+        if (limits.timeoutMs && std::chrono::steady_clock::now() >= deadline)
+            throw ULangError("Timeout (" + std::to_string(limits.timeoutMs) + " ms) exceeded", "ResourceLimitError", current_line, current_column);
+        scheduleLimitCheck();
+    }
+    // Milliseconds left before the timeout, or -1 without one; bounds how long the event loop may wait.
+    long msUntilDeadline() const {
+        if (!limits.timeoutMs) return -1;
+        auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return left > 0 ? (long)((left + 999) / 1000) : 0;
+    }
+    std::shared_ptr<ULangObject> scheduleTailCall(const std::shared_ptr<FunctionObject>& fn, const std::shared_ptr<InstanceObject>& self, const ArgList& args) {
+        tailCall.pending = true;
+        tailCall.fn = fn;
+        tailCall.self = self;
+        tailCall.args.assign(args.begin(), args.end());
+        return nullptr;
+    }
     void pushEnv() {
-        env_stack.push_back(std::map<std::string, std::shared_ptr<ULangObject>>());
-        current_env = &env_stack.back();
+        if (depth == frames.size()) frames.emplace_back();
+        frames[depth].visible = depth > 0 ? frames[depth - 1].visible : 0;
+        depth++;
     }
     void popEnv() {
-        if (env_stack.size() > 1) {
-            env_stack.pop_back();
-            current_env = &env_stack.back();
-        }
+        if (depth > 0) frames[--depth].vars.clear();
+    }
+    void swapState(ExecutionState& other) {
+        std::swap(module, other.module);
+        std::swap(frames, other.frames);
+        std::swap(depth, other.depth);
+        std::swap(valueStack, other.valueStack);
+        std::swap(returning, other.returning);
+        std::swap(returnValue, other.returnValue);
+        std::swap(current_instance, other.current_instance);
+        std::swap(tailCall, other.tailCall);
+        std::swap(callDepth, other.callDepth);
+        std::swap(nativeStackBase, other.nativeStackBase);
+        std::swap(nativeStackSize, other.nativeStackSize);
     }
-    void enterInstanceContext(std::shared_ptr<InstanceObject> instance) { current_instance = instance; }
-    void exitInstanceContext() { current_instance = nullptr; }
     std::shared_ptr<InstanceObject> getCurrentInstance() { return current_instance; }
     void loadLibs();
+    std::string findModule(const std::string& spec);
+    std::shared_ptr<ModuleObject> importModule(const std::string& spec);
+    void memoize(const std::shared_ptr<FunctionObject>& fn, size_t capacity, bool checkPurity);
     std::shared_ptr<ULangObject> executeBlock(const std::vector<std::shared_ptr<ASTNode>>& statements);
 };
 size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* output) {
@@ -373,72 +1211,1708 @@ size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* out
     output->append((char*)contents, total_size);
     return total_size;
 }
-std::shared_ptr<ULangObject> ListObject::getMethod(const std::string& name) {
+// Exponentiation by squaring; false for negative exponents or when the result overflows int64.
+bool integerPow(int64_t base, int64_t exponent, int64_t& out) {
+    if (exponent < 0) return false;
+    int64_t result = 1;
+    while (exponent > 0) {
+        if ((exponent & 1) && __builtin_mul_overflow(result, base, &result)) return false;
+        exponent >>= 1;
+        if (exponent > 0 && __builtin_mul_overflow(base, base, &base)) return false;
+    }
+    out = result;
+    return true;
+}
+std::shared_ptr<ULangObject> ListObject::callMethod(const std::string& name, const ArgList& args) {
     if (name == "append") {
-        return std::make_shared<BuiltinFunction>("append", [this](Interpreter& i, const std::vector<std::shared_ptr<ULangObject>>& args) {
-            if (args.size() != 1) throw_runtime_error("append expects 1 argument.");
-            this->elements.push_back(args[0]);
-            return VOID_INSTANCE;
-        });
+        if (args.size() != 1) throw_runtime_error("append expects 1 argument.");
+        elements.push_back(args[0]);
+        return VOID_INSTANCE;
     }
     if (name == "pop") {
-        return std::make_shared<BuiltinFunction>("pop", [this](Interpreter& i, const std::vector<std::shared_ptr<ULangObject>>& args) {
-            if (this->elements.empty()) throw_runtime_error("Pop from empty list.");
-            auto val = this->elements.back();
-            this->elements.pop_back();
-            return val;
+        if (elements.empty()) throw_runtime_error("Pop from empty list.");
+        auto val = elements.back();
+        elements.pop_back();
+        return val;
+    }
+    throw_runtime_error("Undefined list method '" + name + "'.");
+    return VOID_INSTANCE;
+}
+std::shared_ptr<ULangObject> ListObject::getMethod(const std::string& name) {
+    if (name != "append" && name != "pop") return nullptr;
+    auto self = std::static_pointer_cast<ListObject>(shared_from_this());
+    return std::make_shared<BuiltinFunction>(name, [self, name](Interpreter&, const ArgList& args) {
+        return self->callMethod(name, args);
+    });
+}
+std::shared_ptr<ULangObject> ErrorObject::field(const std::string& name) const {
+    if (name == "type") return std::make_shared<StringObject>(errorType);
+    if (name == "message") return std::make_shared<StringObject>(message);
+    if (name == "line") return NumberObject::integer(line);
+    if (name == "column") return NumberObject::integer(column);
+    throw_runtime_error("Error has no field '" + name + "'; use type, message, line or column.");
+}
+std::shared_ptr<ULangObject> BytesObject::getMethod(const std::string& name) {
+    if (name != "append") return nullptr;
+    auto self = std::static_pointer_cast<BytesObject>(shared_from_this());
+    return std::make_shared<BuiltinFunction>(name, [self](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1) throw_runtime_error("append expects 1 argument");
+        std::string_view more;
+        int64_t byte;
+        if (bytesOf(args[0], more)) self->data.append(more.data(), more.size());
+        else if (args[0]->type == ULangObject::NUMBER && static_cast<NumberObject*>(args[0].get())->asInteger(byte) && byte >= 0 && byte <= 255) self->data.push_back((char)byte);
+        else throw_runtime_error("append expects a string, bytes or a byte value");
+        return VOID_INSTANCE;
+    });
+}
+// FIPS 180-4 SHA-256, hex encoded.
+std::string sha256Hex(std::string_view input) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+    auto compress = [&](const unsigned char* block) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    };
+    // Whole blocks are hashed in place; only the padded tail is copied.
+    size_t whole = input.size() / 64 * 64;
+    for (size_t i = 0; i < whole; i += 64) compress((const unsigned char*)input.data() + i);
+    unsigned char tail[128] = {0};
+    size_t rest = input.size() - whole;
+    std::memcpy(tail, input.data() + whole, rest);
+    tail[rest] = 0x80;
+    size_t tailSize = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)input.size() * 8;
+    for (int i = 0; i < 8; ++i) tail[tailSize - 1 - i] = (unsigned char)(bits >> (i * 8));
+    for (size_t i = 0; i < tailSize; i += 64) compress(tail + i);
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    for (uint32_t word : h)
+        for (int shift = 28; shift >= 0; shift -= 4) hex.push_back(digits[(word >> shift) & 0xf]);
+    return hex;
+}
+bool readWholeFile(const std::string& path, std::string& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    file.seekg(0, std::ios::end);
+    out.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(&out[0], (std::streamsize)out.size());
+    return (bool)file;
+}
+// First occurrence of needle in hay at or after `from`. On x86-64 it compares the needle's first and
+// last bytes against 16 candidate positions at once and only memcmp's the positions where both match;
+// elsewhere it falls back to memchr, which libc vectorises itself.
+size_t findBytes(std::string_view hay, std::string_view needle, size_t from) {
+    size_t n = hay.size(), m = needle.size();
+    if (from > n || m > n - from) return std::string_view::npos;
+    if (m == 0) return from;
+    const char* h = hay.data();
+    size_t i = from;
+#if defined(__SSE2__)
+    if (m > 1) {
+        const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[m - 1]);
+        for (; i + m + 15 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(h + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(h + i + m - 1));
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while (mask) {
+                unsigned bit = (unsigned)__builtin_ctz(mask);
+                if (std::memcmp(h + i + bit + 1, needle.data() + 1, m - 2) == 0) return i + bit;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    while (i + m <= n) {
+        auto hit = (const char*)std::memchr(h + i, needle[0], n - m + 1 - i);
+        if (!hit) break;
+        i = (size_t)(hit - h);
+        if (std::memcmp(h + i + 1, needle.data() + 1, m - 1) == 0) return i;
+        ++i;
+    }
+    return std::string_view::npos;
+}
+// Non-overlapping occurrences of needle; single bytes are counted 16 at a time.
+size_t countBytes(std::string_view hay, std::string_view needle) {
+    if (needle.empty()) return hay.size() + 1;
+    size_t count = 0, i = 0;
+    if (needle.size() == 1) {
+#if defined(__SSE2__)
+        const __m128i c = _mm_set1_epi8(needle[0]);
+        for (; i + 16 <= hay.size(); i += 16)
+            count += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(hay.data() + i)), c)));
+#endif
+        for (; i < hay.size(); ++i) count += hay[i] == needle[0];
+        return count;
+    }
+    while ((i = findBytes(hay, needle, i)) != std::string_view::npos) { ++count; i += needle.size(); }
+    return count;
+}
+// Regular expressions are compiled once to a Thompson NFA, and matching never backtracks, so time is
+// linear in the input. A DFA is built lazily from NFA state sets as input is seen; it answers
+// matches() and rejects non-matching input for search(), and a Pike VM over the same NFA finds the
+// leftmost-longest match when there is one. Supports . [] [^] \d \w \s (and negations), groups,
+// | * + ? {m,n}; ^ and $ anchor the whole pattern.
+class Regex {
+    struct Node {
+        enum Kind { SET, CAT, ALT, REPEAT, EMPTY } kind;
+        int set = 0, min = 0, max = 0; // max < 0: unbounded
+        std::vector<std::unique_ptr<Node>> kids;
+        Node(Kind k) : kind(k) {}
+    };
+    struct State {
+        enum Kind { CHARS, SPLIT, MATCH } kind;
+        int set, out, out1;
+    };
+    struct Dfa {
+        bool unanchored;
+        std::vector<std::vector<int>> sets;
+        std::vector<std::array<int, 256>> next;
+        std::vector<char> accepting;
+        std::map<std::vector<int>, int> ids;
+    };
+    static constexpr size_t maxDfaStates = 4096;
+    std::string pattern;
+    size_t pos = 0;
+    std::vector<std::bitset<256>> sets;
+    std::vector<State> states;
+    int start = 0;
+    bool anchorStart = false, anchorEnd = false;
+    Dfa anchored{false, {}, {}, {}, {}}, unanchored{true, {}, {}, {}, {}};
+    std::vector<size_t> seen;
+
+    [[noreturn]] void fail(const std::string& why) { throw ULangError("Invalid regex '" + pattern + "': " + why, "Runtime", current_line, current_column); }
+    int addSet(const std::bitset<256>& set) { sets.push_back(set); return (int)sets.size() - 1; }
+    std::unique_ptr<Node> setNode(const std::bitset<256>& set) { auto n = std::make_unique<Node>(Node::SET); n->set = addSet(set); return n; }
+    static std::bitset<256> classOf(char c) {
+        std::bitset<256> set;
+        for (int i = 0; i < 256; ++i) {
+            bool in = c == 'd' || c == 'D' ? std::isdigit(i) : c == 'w' || c == 'W' ? (std::isalnum(i) || i == '_') : std::isspace(i);
+            set[i] = in;
+        }
+        if (std::isupper((unsigned char)c)) set.flip();
+        return set;
+    }
+    int escapeChar(char c) {
+        switch (c) { case 'n': return '\n'; case 't': return '\t'; case 'r': return '\r'; case '0': return 0; default: return (unsigned char)c; }
+    }
+    std::unique_ptr<Node> parseClass() {
+        std::bitset<256> set;
+        bool negate = pos < pattern.size() && pattern[pos] == '^';
+        if (negate) ++pos;
+        bool firstChar = true;
+        while (pos < pattern.size() && (pattern[pos] != ']' || firstChar)) {
+            firstChar = false;
+            int lo = (unsigned char)pattern[pos++];
+            if (lo == '\\') {
+                if (pos >= pattern.size()) fail("trailing backslash");
+                char e = pattern[pos++];
+                if (std::strchr("dDwWsS", e)) { set |= classOf(e); continue; }
+                lo = escapeChar(e);
+            }
+            int hi = lo;
+            if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']') {
+                ++pos;
+                hi = (unsigned char)pattern[pos++];
+                if (hi == '\\') {
+                    if (pos >= pattern.size()) fail("trailing backslash");
+                    hi = escapeChar(pattern[pos++]);
+                }
+                if (hi < lo) fail("bad character range");
+            }
+            for (int c = lo; c <= hi; ++c) set[c] = true;
+        }
+        if (pos >= pattern.size()) fail("missing ]");
+        ++pos;
+        if (negate) set.flip();
+        return setNode(set);
+    }
+    std::unique_ptr<Node> parseAtom() {
+        char c = pattern[pos++];
+        if (c == '(') {
+            if (pattern.compare(pos, 2, "?:") == 0) pos += 2;
+            auto inner = parseAlt();
+            if (pos >= pattern.size() || pattern[pos] != ')') fail("missing )");
+            ++pos;
+            return inner;
+        }
+        if (c == '[') return parseClass();
+        std::bitset<256> set;
+        if (c == '.') { set.set(); set['\n'] = false; return setNode(set); }
+        if (c == '^' || c == '$') fail("^ and $ are only supported at the start and end of the pattern");
+        if (c == '*' || c == '+' || c == '?' || c == '{') fail(std::string("nothing to repeat before '") + c + "'");
+        int ch = (unsigned char)c;
+        if (c == '\\') {
+            if (pos >= pattern.size()) fail("trailing backslash");
+            char e = pattern[pos++];
+            if (std::strchr("dDwWsS", e)) return setNode(classOf(e));
+            ch = escapeChar(e);
+        }
+        set[ch] = true;
+        return setNode(set);
+    }
+    bool parseCount(int& out) {
+        size_t begin = pos;
+        out = 0;
+        while (pos < pattern.size() && std::isdigit((unsigned char)pattern[pos])) {
+            out = out * 10 + (pattern[pos++] - '0');
+            if (out > 1000) fail("repetition count above 1000");
+        }
+        return pos > begin;
+    }
+    std::unique_ptr<Node> parseRepeat() {
+        auto atom = parseAtom();
+        while (pos < pattern.size()) {
+            int min, max;
+            char c = pattern[pos];
+            if (c == '*') { min = 0; max = -1; }
+            else if (c == '+') { min = 1; max = -1; }
+            else if (c == '?') { min = 0; max = 1; }
+            else if (c == '{') {
+                ++pos;
+                if (!parseCount(min)) fail("bad {m,n}");
+                max = min;
+                if (pos < pattern.size() && pattern[pos] == ',') { ++pos; if (!parseCount(max)) max = -1; }
+                if (pos >= pattern.size() || pattern[pos] != '}' || (max >= 0 && max < min)) fail("bad {m,n}");
+            } else break;
+            ++pos;
+            auto rep = std::make_unique<Node>(Node::REPEAT);
+            rep->min = min;
+            rep->max = max;
+            rep->kids.push_back(std::move(atom));
+            atom = std::move(rep);
+        }
+        return atom;
+    }
+    bool atTrailingDollar() const { return pos + 1 == pattern.size() && pattern[pos] == '$'; }
+    std::unique_ptr<Node> parseCat() {
+        auto cat = std::make_unique<Node>(Node::CAT);
+        while (pos < pattern.size() && pattern[pos] != '|' && pattern[pos] != ')' && !atTrailingDollar())
+            cat->kids.push_back(parseRepeat());
+        return cat;
+    }
+    std::unique_ptr<Node> parseAlt() {
+        auto first = parseCat();
+        if (pos >= pattern.size() || pattern[pos] != '|') return first;
+        auto alt = std::make_unique<Node>(Node::ALT);
+        alt->kids.push_back(std::move(first));
+        while (pos < pattern.size() && pattern[pos] == '|') { ++pos; alt->kids.push_back(parseCat()); }
+        return alt;
+    }
+    int addState(State::Kind kind, int set, int out, int out1 = -1) {
+        if (states.size() > 100000) fail("pattern too large");
+        states.push_back({kind, set, out, out1});
+        return (int)states.size() - 1;
+    }
+    // Builds the NFA for n so that it continues to state `next`, returning its entry state.
+    int compile(const Node& n, int next) {
+        switch (n.kind) {
+            case Node::EMPTY: return next;
+            case Node::SET: return addState(State::CHARS, n.set, next);
+            case Node::CAT:
+                for (auto it = n.kids.rbegin(); it != n.kids.rend(); ++it) next = compile(**it, next);
+                return next;
+            case Node::ALT: {
+                int entry = compile(*n.kids.back(), next);
+                for (size_t i = n.kids.size() - 1; i-- > 0;) entry = addState(State::SPLIT, -1, compile(*n.kids[i], next), entry);
+                return entry;
+            }
+            case Node::REPEAT: {
+                const Node& kid = *n.kids[0];
+                int tail = next;
+                if (n.max < 0) {
+                    tail = addState(State::SPLIT, -1, -1, next);
+                    states[tail].out = compile(kid, tail);
+                } else {
+                    for (int i = n.min; i < n.max; ++i) tail = addState(State::SPLIT, -1, compile(kid, tail), next);
+                }
+                for (int i = 0; i < n.min; ++i) tail = compile(kid, tail);
+                return tail;
+            }
+        }
+        return next;
+    }
+    void closure(int s, size_t mark, std::vector<int>& out) {
+        if (seen[s] == mark) return;
+        seen[s] = mark;
+        if (states[s].kind == State::SPLIT) { closure(states[s].out, mark, out); closure(states[s].out1, mark, out); }
+        else out.push_back(s);
+    }
+    size_t generation = 0;
+    int dfaState(Dfa& dfa, std::vector<int>&& set) {
+        std::sort(set.begin(), set.end());
+        auto found = dfa.ids.find(set);
+        if (found != dfa.ids.end()) return found->second;
+        bool accepting = false;
+        for (int s : set) accepting |= states[s].kind == State::MATCH;
+        int id = (int)dfa.sets.size();
+        dfa.ids.emplace(set, id);
+        dfa.sets.push_back(std::move(set));
+        std::array<int, 256> unknown;
+        unknown.fill(-1);
+        dfa.next.push_back(unknown);
+        dfa.accepting.push_back(accepting);
+        return id;
+    }
+    int dfaStart(Dfa& dfa) {
+        if (!dfa.sets.empty()) return 0;
+        std::vector<int> set;
+        closure(start, ++generation, set);
+        return dfaState(dfa, std::move(set));
+    }
+    // The DFA is bounded: when it outgrows maxDfaStates it is thrown away and rebuilt from the current state.
+    int dfaStep(Dfa& dfa, int from, unsigned char c) {
+        int cached = dfa.next[from][c];
+        if (cached >= 0) return cached;
+        std::vector<int> set;
+        size_t mark = ++generation;
+        for (int s : dfa.sets[from])
+            if (states[s].kind == State::CHARS && sets[states[s].set][c]) closure(states[s].out, mark, set);
+        if (dfa.unanchored) closure(start, mark, set);
+        if (dfa.sets.size() >= maxDfaStates) {
+            std::vector<int> startSet;
+            closure(start, ++generation, startSet);
+            dfa.sets.clear(); dfa.next.clear(); dfa.accepting.clear(); dfa.ids.clear();
+            dfaState(dfa, std::move(startSet));
+            return dfaState(dfa, std::move(set));
+        }
+        int to = dfaState(dfa, std::move(set));
+        dfa.next[from][c] = to;
+        return to;
+    }
+    // Whether some match ends in text[from..]; without $ it stops at the first one.
+    bool anyMatch(std::string_view text, size_t from) {
+        Dfa& dfa = anchorStart ? anchored : unanchored;
+        int s = dfaStart(dfa);
+        if (!anchorEnd && dfa.accepting[s]) return true;
+        for (size_t i = from; i < text.size(); ++i) {
+            s = dfaStep(dfa, s, (unsigned char)text[i]);
+            if (dfa.accepting[s] && !anchorEnd) return true;
+            if (dfa.sets[s].empty() && !dfa.unanchored) return false;
+        }
+        return dfa.accepting[s];
+    }
+public:
+    explicit Regex(const std::string& p) : pattern(p) {
+        if (!pattern.empty() && pattern[0] == '^') { anchorStart = true; pos = 1; }
+        auto root = parseAlt();
+        if (pos < pattern.size() && pattern[pos] == ')') fail("unmatched )");
+        if (atTrailingDollar()) anchorEnd = true;
+        if ((anchorStart || anchorEnd) && root->kind == Node::ALT) fail("anchors apply to the whole pattern; group the alternatives, e.g. ^(a|b)$");
+        start = compile(*root, addState(State::MATCH, -1, -1));
+        seen.assign(states.size(), 0);
+    }
+    bool matches(std::string_view text) {
+        int s = dfaStart(anchored);
+        for (char c : text) {
+            s = dfaStep(anchored, s, (unsigned char)c);
+            if (anchored.sets[s].empty()) return false;
+        }
+        return anchored.accepting[s];
+    }
+    // Leftmost-longest match starting at or after `from`.
+    bool search(std::string_view text, size_t from, size_t& matchStart, size_t& matchEnd) {
+        if ((anchorStart && from > 0) || !anyMatch(text, from)) return false;
+        struct Thread { int state; size_t begin; };
+        std::vector<Thread> current, next;
+        std::vector<int> entry;
+        bool found = false;
+        auto add = [&](std::vector<Thread>& list, int s, size_t begin, size_t mark) {
+            entry.clear();
+            closure(s, mark, entry);
+            for (int e : entry) list.push_back({e, begin});
+        };
+        size_t mark = ++generation;
+        for (size_t i = from; i <= text.size(); ++i) {
+            // Earlier starts are added first, so they win when two threads reach the same state.
+            if (!found && (!anchorStart || i == 0)) add(current, start, i, mark);
+            if (current.empty()) break;
+            mark = ++generation;
+            next.clear();
+            for (auto& t : current) {
+                if (found && t.begin > matchStart) continue;
+                const State& st = states[t.state];
+                if (st.kind == State::MATCH) {
+                    if ((!anchorEnd || i == text.size()) && (!found || t.begin < matchStart || (t.begin == matchStart && i > matchEnd))) {
+                        found = true;
+                        matchStart = t.begin;
+                        matchEnd = i;
+                    }
+                } else if (i < text.size() && sets[st.set][(unsigned char)text[i]]) {
+                    add(next, st.out, t.begin, mark);
+                }
+            }
+            std::swap(current, next);
+            if (found && current.empty()) break;
+        }
+        return found;
+    }
+    // Compiled patterns are cached by their source text; the cache is simply emptied when it fills up.
+    static std::shared_ptr<Regex> compiled(const std::string& pattern) {
+        static std::unordered_map<std::string, std::shared_ptr<Regex>> cache;
+        auto found = cache.find(pattern);
+        if (found != cache.end()) return found->second;
+        if (cache.size() >= 256) cache.clear();
+        auto regex = std::make_shared<Regex>(pattern);
+        cache.emplace(pattern, regex);
+        return regex;
+    }
+};
+// Integer indices are used directly; other numbers must be integral.
+size_t checkedIndex(size_t size, const std::shared_ptr<ULangObject>& index, const char* kind) {
+    int64_t i;
+    if (index->type != ULangObject::NUMBER || !static_cast<NumberObject*>(index.get())->asInteger(i)) throw_runtime_error(std::string(kind) + " index must be an integer");
+    if (i < 0 || (uint64_t)i >= size) throw_runtime_error(std::string(kind) + " index out of range");
+    return (size_t)i;
+}
+size_t listIndex(const ListObject& list, const std::shared_ptr<ULangObject>& index) { return checkedIndex(list.elements.size(), index, "List"); }
+static std::string_view textArg(const std::shared_ptr<ULangObject>& v, const char* method) {
+    if (v->type != ULangObject::STRING) throw_runtime_error(std::string(method) + " expects a string argument");
+    return static_cast<StringObject*>(v.get())->view();
+}
+static int64_t intArg(const std::shared_ptr<ULangObject>& v, const char* method) {
+    int64_t i;
+    if (v->type != ULangObject::NUMBER || !static_cast<NumberObject*>(v.get())->asInteger(i)) throw_runtime_error(std::string(method) + " expects an integer argument");
+    return i;
+}
+std::shared_ptr<ULangObject> StringObject::getMethod(const std::string& name) {
+    using Method = std::shared_ptr<ULangObject> (*)(const std::shared_ptr<StringObject>&, const ArgList&);
+    static const std::unordered_map<std::string, Method> methods = {
+        {"find", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() < 1 || args.size() > 2) throw_runtime_error("find expects 1 or 2 arguments: SUBSTRING, [START]");
+            int64_t from = args.size() == 2 ? std::max<int64_t>(0, intArg(args[1], "find")) : 0;
+            size_t at = findBytes(self->view(), textArg(args[0], "find"), (size_t)from);
+            return NumberObject::integer(at == std::string_view::npos ? -1 : (int64_t)at);
+        }},
+        {"count", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error("count expects 1 argument");
+            return NumberObject::integer((int64_t)countBytes(self->view(), textArg(args[0], "count")));
+        }},
+        // Pieces are views into this string, so splitting a large response does not copy it.
+        {"split", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() > 1) throw_runtime_error("split expects at most 1 argument: SEPARATOR");
+            std::string_view s = self->view();
+            std::vector<std::shared_ptr<ULangObject>> parts;
+            if (args.empty()) {
+                size_t i = 0;
+                while (true) {
+                    while (i < s.size() && std::isspace((unsigned char)s[i])) ++i;
+                    if (i == s.size()) break;
+                    size_t j = i;
+                    while (j < s.size() && !std::isspace((unsigned char)s[j])) ++j;
+                    parts.push_back(StringObject::slice(self, i, j - i));
+                    i = j;
+                }
+            } else {
+                std::string_view sep = textArg(args[0], "split");
+                if (sep.empty()) throw_runtime_error("split separator must not be empty");
+                size_t i = 0, at;
+                while ((at = findBytes(s, sep, i)) != std::string_view::npos) {
+                    parts.push_back(StringObject::slice(self, i, at - i));
+                    i = at + sep.size();
+                }
+                parts.push_back(StringObject::slice(self, i, s.size() - i));
+            }
+            return std::make_shared<ListObject>(parts);
+        }},
+        {"replace", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 2) throw_runtime_error("replace expects 2 arguments: OLD, NEW");
+            std::string_view s = self->view(), from = textArg(args[0], "replace"), to = textArg(args[1], "replace");
+            if (from.empty()) throw_runtime_error("replace: OLD must not be empty");
+            size_t i = 0, at = findBytes(s, from, 0);
+            if (at == std::string_view::npos) return self;
+            std::string out;
+            out.reserve(s.size());
+            for (; at != std::string_view::npos; at = findBytes(s, from, i)) {
+                out.append(s.data() + i, at - i).append(to.data(), to.size());
+                i = at + from.size();
+            }
+            out.append(s.data() + i, s.size() - i);
+            return std::make_shared<StringObject>(std::move(out));
+        }},
+        {"substr", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() < 1 || args.size() > 2) throw_runtime_error("substr expects 1 or 2 arguments: START, [LENGTH]");
+            int64_t size = (int64_t)self->size();
+            int64_t begin = std::clamp<int64_t>(intArg(args[0], "substr"), 0, size);
+            int64_t n = args.size() == 2 ? std::clamp<int64_t>(intArg(args[1], "substr"), 0, size - begin) : size - begin;
+            return StringObject::slice(self, (size_t)begin, (size_t)n);
+        }},
+        {"upper", [](const std::shared_ptr<StringObject>& self, const ArgList&) -> std::shared_ptr<ULangObject> {
+            std::string out = self->str();
+            for (auto& c : out) c = (char)std::toupper((unsigned char)c);
+            return std::make_shared<StringObject>(std::move(out));
+        }},
+        {"lower", [](const std::shared_ptr<StringObject>& self, const ArgList&) -> std::shared_ptr<ULangObject> {
+            std::string out = self->str();
+            for (auto& c : out) c = (char)std::tolower((unsigned char)c);
+            return std::make_shared<StringObject>(std::move(out));
+        }},
+        {"trim", [](const std::shared_ptr<StringObject>& self, const ArgList&) -> std::shared_ptr<ULangObject> {
+            std::string_view s = self->view();
+            size_t b = 0, e = s.size();
+            while (b < e && std::isspace((unsigned char)s[b])) ++b;
+            while (e > b && std::isspace((unsigned char)s[e - 1])) --e;
+            return StringObject::slice(self, b, e - b);
+        }},
+        {"startsWith", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error("startsWith expects 1 argument");
+            std::string_view s = self->view(), p = textArg(args[0], "startsWith");
+            return std::make_shared<BooleanObject>(s.substr(0, p.size()) == p);
+        }},
+        {"endsWith", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error("endsWith expects 1 argument");
+            std::string_view s = self->view(), p = textArg(args[0], "endsWith");
+            return std::make_shared<BooleanObject>(s.size() >= p.size() && s.substr(s.size() - p.size()) == p);
+        }},
+        {"matches", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error("matches expects 1 argument: PATTERN");
+            return std::make_shared<BooleanObject>(Regex::compiled(std::string(textArg(args[0], "matches")))->matches(self->view()));
+        }},
+        {"search", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error("search expects 1 argument: PATTERN");
+            size_t b, e;
+            if (!Regex::compiled(std::string(textArg(args[0], "search")))->search(self->view(), 0, b, e)) return VOID_INSTANCE;
+            return StringObject::slice(self, b, e - b);
+        }},
+        {"findAll", [](const std::shared_ptr<StringObject>& self, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error("findAll expects 1 argument: PATTERN");
+            auto regex = Regex::compiled(std::string(textArg(args[0], "findAll")));
+            std::string_view s = self->view();
+            std::vector<std::shared_ptr<ULangObject>> found;
+            size_t from = 0, b, e;
+            while (from <= s.size() && regex->search(s, from, b, e)) {
+                found.push_back(StringObject::slice(self, b, e - b));
+                from = e > b ? e : e + 1;
+            }
+            return std::make_shared<ListObject>(found);
+        }},
+    };
+    auto method = methods.find(name);
+    if (method == methods.end()) return nullptr;
+    auto self = std::static_pointer_cast<StringObject>(shared_from_this());
+    Method fn = method->second;
+    return std::make_shared<BuiltinFunction>(name, [self, fn](Interpreter&, const ArgList& args) { return fn(self, args); });
+}
+// Distinct strings of a text column. Cells store codes into `values`, so a repeated value is stored
+// once and reading a cell hands out the same StringObject instead of allocating one.
+struct StringPool {
+    std::vector<std::shared_ptr<StringObject>> values;
+    std::unordered_map<std::string_view, uint32_t> codes; // keys view the strings in `values`
+    uint32_t intern(std::string_view s) {
+        auto found = codes.find(s);
+        if (found != codes.end()) return found->second;
+        values.push_back(std::make_shared<StringObject>(std::string(s)));
+        uint32_t code = (uint32_t)values.size() - 1;
+        codes.emplace(values.back()->view(), code);
+        return code;
+    }
+};
+struct TableColumn {
+    enum Kind { INT, FLOAT, STRING } kind = INT;
+    std::string name;
+    std::vector<int64_t> ints;
+    std::vector<double> floats;
+    std::vector<uint32_t> codes;
+    std::shared_ptr<StringPool> pool;
+    static const char* kindName(Kind k) { return k == INT ? "int" : k == FLOAT ? "float" : "string"; }
+    void resize(size_t n) {
+        if (kind == INT) ints.resize(n);
+        else if (kind == FLOAT) floats.resize(n);
+        else codes.resize(n);
+    }
+    std::shared_ptr<ULangObject> value(size_t row) const {
+        if (kind == INT) return NumberObject::integer(ints[row]);
+        if (kind == FLOAT) return std::make_shared<NumberObject>(floats[row]);
+        return pool->values[codes[row]];
+    }
+    // A column of the same kind holding the given rows, in order.
+    TableColumn gather(const std::vector<uint32_t>& rows) const {
+        TableColumn out;
+        out.kind = kind;
+        out.name = name;
+        out.pool = pool;
+        if (kind == INT) { out.ints.reserve(rows.size()); for (auto r : rows) out.ints.push_back(ints[r]); }
+        else if (kind == FLOAT) { out.floats.reserve(rows.size()); for (auto r : rows) out.floats.push_back(floats[r]); }
+        else { out.codes.reserve(rows.size()); for (auto r : rows) out.codes.push_back(codes[r]); }
+        return out;
+    }
+};
+// A table of typed columns, each one contiguous array; made by read_csv, filter, group_by and head.
+class TableObject : public ULangObject {
+public:
+    std::vector<TableColumn> columns;
+    size_t rows = 0;
+    TableObject() : ULangObject(TABLE) {}
+    const TableColumn& column(std::string_view name) const {
+        for (auto& c : columns) if (c.name == name) return c;
+        throw_runtime_error("Table has no column '" + std::string(name) + "'");
+    }
+    std::shared_ptr<TableObject> gather(const std::vector<uint32_t>& selected) const {
+        auto out = std::make_shared<TableObject>();
+        for (auto& c : columns) out->columns.push_back(c.gather(selected));
+        out->rows = selected.size();
+        return out;
+    }
+    std::string toString() const override {
+        std::string s = "<table " + std::to_string(rows) + " rows:";
+        for (auto& c : columns) s += " " + c.name + " " + TableColumn::kindName(c.kind) + ",";
+        if (!columns.empty()) s.pop_back();
+        return s + ">";
+    }
+    bool isTruthy() const override { return rows != 0; }
+    std::shared_ptr<ULangObject> getMethod(const std::string& name) override;
+};
+// Folds column values into one result per group: groupOf[row] names the row's group, or every row is
+// in group 0 when groupOf is null. Integer sums stay exact until they overflow, then become doubles.
+// NaN cells (empty in the file) are skipped; a group with no other value yields NaN, or 0 for sum.
+TableColumn aggregateColumn(const TableColumn& col, const std::vector<uint32_t>* groupOf, size_t groups, const std::string& agg) {
+    TableColumn out;
+    out.name = col.name;
+    size_t n = col.kind == TableColumn::INT ? col.ints.size() : col.kind == TableColumn::FLOAT ? col.floats.size() : col.codes.size();
+    auto group = [&](size_t row) -> size_t { return groupOf ? (*groupOf)[row] : 0; };
+    if (agg == "count") {
+        out.kind = TableColumn::INT;
+        out.ints.assign(groups, 0);
+        for (size_t r = 0; r < n; ++r) out.ints[group(r)]++;
+        return out;
+    }
+    bool isMin = agg == "min", isMax = agg == "max", isSum = agg == "sum", isMean = agg == "mean";
+    if (!isMin && !isMax && !isSum && !isMean) throw_runtime_error("Unknown aggregate '" + agg + "'; use sum, mean, min, max or count");
+    std::vector<char> seen(groups, 0);
+    if (col.kind == TableColumn::STRING) {
+        if (!isMin && !isMax) throw_runtime_error("Only min, max and count apply to string column '" + col.name + "'");
+        out.kind = TableColumn::STRING;
+        out.pool = col.pool;
+        out.codes.assign(groups, 0);
+        for (size_t r = 0; r < n; ++r) {
+            size_t g = group(r);
+            uint32_t code = col.codes[r];
+            auto v = col.pool->values[code]->view(), best = col.pool->values[out.codes[g]]->view();
+            if (!seen[g] || (isMin ? v < best : v > best)) { out.codes[g] = code; seen[g] = 1; }
+        }
+        return out;
+    }
+    if (col.kind == TableColumn::INT && !isMean) {
+        std::vector<int64_t> acc(groups, 0);
+        std::vector<double> spill;
+        bool overflowed = false;
+        for (size_t r = 0; r < n; ++r) {
+            size_t g = group(r);
+            int64_t v = col.ints[r];
+            if (isSum) {
+                if (!overflowed && __builtin_add_overflow(acc[g], v, &acc[g])) {
+                    overflowed = true;
+                    spill.assign(groups, 0.0);
+                    // Recount in doubles from scratch; the exact partial sums are no longer trustworthy.
+                    for (size_t q = 0; q <= r; ++q) spill[group(q)] += (double)col.ints[q];
+                } else if (overflowed) {
+                    spill[g] += (double)v;
+                }
+            } else if (!seen[g] || (isMin ? v < acc[g] : v > acc[g])) {
+                acc[g] = v;
+                seen[g] = 1;
+            }
+        }
+        if (overflowed) { out.kind = TableColumn::FLOAT; out.floats = std::move(spill); }
+        else { out.kind = TableColumn::INT; out.ints = std::move(acc); }
+        return out;
+    }
+    out.kind = TableColumn::FLOAT;
+    out.floats.assign(groups, isMin || isMax ? std::nan("") : 0.0);
+    std::vector<int64_t> counts(isMean ? groups : 0, 0);
+    for (size_t r = 0; r < n; ++r) {
+        size_t g = group(r);
+        double v = col.kind == TableColumn::INT ? (double)col.ints[r] : col.floats[r];
+        if (std::isnan(v)) continue;
+        if (isSum || isMean) {
+            out.floats[g] += v;
+            if (isMean) counts[g]++;
+        } else if (!seen[g] || (isMin ? v < out.floats[g] : v > out.floats[g])) {
+            out.floats[g] = v;
+            seen[g] = 1;
+        }
+    }
+    if (isMean) for (size_t g = 0; g < groups; ++g) out.floats[g] = counts[g] ? out.floats[g] / (double)counts[g] : std::nan("");
+    return out;
+}
+// Rows where `column op value` holds. Numbers compare numerically; a string column compares with a
+// string, and == / != on it compare interned codes after a single lookup of the value.
+std::vector<uint32_t> selectRows(const TableColumn& col, const std::string& op, const std::shared_ptr<ULangObject>& value) {
+    enum { EQ, NE, LT, LE, GT, GE } cmp;
+    if (op == "==") cmp = EQ; else if (op == "!=") cmp = NE; else if (op == "<") cmp = LT;
+    else if (op == "<=") cmp = LE; else if (op == ">") cmp = GT; else if (op == ">=") cmp = GE;
+    else throw_runtime_error("filter operator must be one of == != < <= > >=");
+    std::vector<uint32_t> rows;
+    auto keep = [&](int order) {
+        switch (cmp) {
+            case EQ: return order == 0;
+            case NE: return order != 0;
+            case LT: return order < 0;
+            case LE: return order <= 0;
+            case GT: return order > 0;
+            default: return order >= 0;
+        }
+    };
+    if (col.kind == TableColumn::STRING) {
+        if (value->type != ULangObject::STRING) throw_runtime_error("Column '" + col.name + "' holds strings; compare it with a string");
+        std::string_view target = static_cast<StringObject*>(value.get())->view();
+        if (cmp == EQ || cmp == NE) {
+            auto found = col.pool->codes.find(target);
+            int64_t code = found == col.pool->codes.end() ? -1 : found->second;
+            for (size_t r = 0; r < col.codes.size(); ++r)
+                if (((int64_t)col.codes[r] == code) == (cmp == EQ)) rows.push_back((uint32_t)r);
+            return rows;
+        }
+        // Each distinct string is compared once, then rows are selected by code.
+        std::vector<char> match(col.pool->values.size());
+        for (size_t c = 0; c < match.size(); ++c) match[c] = keep(col.pool->values[c]->view().compare(target));
+        for (size_t r = 0; r < col.codes.size(); ++r) if (match[col.codes[r]]) rows.push_back((uint32_t)r);
+        return rows;
+    }
+    if (value->type != ULangObject::NUMBER) throw_runtime_error("Column '" + col.name + "' holds numbers; compare it with a number");
+    auto number = static_cast<NumberObject*>(value.get());
+    int64_t exact;
+    if (col.kind == TableColumn::INT && number->asInteger(exact)) {
+        for (size_t r = 0; r < col.ints.size(); ++r) {
+            int64_t v = col.ints[r];
+            if (keep(v < exact ? -1 : v > exact ? 1 : 0)) rows.push_back((uint32_t)r);
+        }
+        return rows;
+    }
+    double target = number->toDouble();
+    size_t n = col.kind == TableColumn::INT ? col.ints.size() : col.floats.size();
+    for (size_t r = 0; r < n; ++r) {
+        double v = col.kind == TableColumn::INT ? (double)col.ints[r] : col.floats[r];
+        // NaN (an empty cell) only satisfies !=.
+        if (v != v || target != target) { if (cmp == NE) rows.push_back((uint32_t)r); continue; }
+        if (keep(v < target ? -1 : v > target ? 1 : 0)) rows.push_back((uint32_t)r);
+    }
+    return rows;
+}
+std::shared_ptr<ULangObject> TableObject::getMethod(const std::string& name) {
+    auto self = std::static_pointer_cast<TableObject>(shared_from_this());
+    auto method = [&](auto fn) { return std::make_shared<BuiltinFunction>(name, [self, fn](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> { return fn(*self, args); }); };
+    if (name == "columns") return method([](TableObject& t, const ArgList&) -> std::shared_ptr<ULangObject> {
+        std::vector<std::shared_ptr<ULangObject>> names;
+        for (auto& c : t.columns) names.push_back(std::make_shared<StringObject>(c.name));
+        return std::make_shared<ListObject>(names);
+    });
+    if (name == "column") return method([](TableObject& t, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1) throw_runtime_error("column expects 1 argument: NAME");
+        auto& col = t.column(textArg(args[0], "column"));
+        std::vector<std::shared_ptr<ULangObject>> values;
+        values.reserve(t.rows);
+        for (size_t r = 0; r < t.rows; ++r) values.push_back(col.value(r));
+        return std::make_shared<ListObject>(values);
+    });
+    if (name == "row") return method([](TableObject& t, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1) throw_runtime_error("row expects 1 argument: INDEX");
+        size_t r = checkedIndex(t.rows, args[0], "Row");
+        std::vector<std::shared_ptr<ULangObject>> values;
+        for (auto& c : t.columns) values.push_back(c.value(r));
+        return std::make_shared<ListObject>(values);
+    });
+    if (name == "head") return method([](TableObject& t, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1) throw_runtime_error("head expects 1 argument: COUNT");
+        std::vector<uint32_t> rows((size_t)std::clamp<int64_t>(intArg(args[0], "head"), 0, (int64_t)t.rows));
+        for (size_t r = 0; r < rows.size(); ++r) rows[r] = (uint32_t)r;
+        return t.gather(rows);
+    });
+    if (name == "filter") return method([](TableObject& t, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 3) throw_runtime_error("filter expects 3 arguments: COLUMN, OPERATOR, VALUE");
+        return t.gather(selectRows(t.column(textArg(args[0], "filter")), std::string(textArg(args[1], "filter")), args[2]));
+    });
+    if (name == "count") return method([](TableObject& t, const ArgList&) -> std::shared_ptr<ULangObject> { return NumberObject::integer((int64_t)t.rows); });
+    if (name == "sum" || name == "mean" || name == "min" || name == "max") {
+        std::string agg = name;
+        return std::make_shared<BuiltinFunction>(name, [self, agg](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+            if (args.size() != 1) throw_runtime_error(agg + " expects 1 argument: COLUMN");
+            auto& col = self->column(textArg(args[0], agg.c_str()));
+            if (self->rows == 0 && agg != "sum") return VOID_INSTANCE;
+            return aggregateColumn(col, nullptr, 1, agg).value(0);
         });
     }
+    // group_by(KEY, AGGREGATE, [COLUMN]): one row per distinct key, in order of first appearance,
+    // with the aggregate of COLUMN (or the row count) over that key's rows.
+    if (name == "group_by") return method([](TableObject& t, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() < 2 || args.size() > 3) throw_runtime_error("group_by expects 2 or 3 arguments: KEY, AGGREGATE, [COLUMN]");
+        auto& key = t.column(textArg(args[0], "group_by"));
+        std::string agg(textArg(args[1], "group_by"));
+        if (args.size() == 2 && agg != "count") throw_runtime_error("group_by needs a COLUMN for '" + agg + "'");
+        const TableColumn& values = args.size() == 3 ? t.column(textArg(args[2], "group_by")) : key;
+        std::vector<uint32_t> groupOf(t.rows), firstRow;
+        if (key.kind == TableColumn::STRING) {
+            // Codes are dense, so the group of a key is an array lookup.
+            std::vector<int64_t> groupOfCode(key.pool->values.size(), -1);
+            for (size_t r = 0; r < t.rows; ++r) {
+                auto& g = groupOfCode[key.codes[r]];
+                if (g < 0) { g = (int64_t)firstRow.size(); firstRow.push_back((uint32_t)r); }
+                groupOf[r] = (uint32_t)g;
+            }
+        } else {
+            std::unordered_map<uint64_t, uint32_t> groupOfKey;
+            for (size_t r = 0; r < t.rows; ++r) {
+                uint64_t bits;
+                if (key.kind == TableColumn::INT) bits = (uint64_t)key.ints[r];
+                else { double d = key.floats[r] == 0.0 ? 0.0 : key.floats[r]; std::memcpy(&bits, &d, sizeof bits); }
+                auto inserted = groupOfKey.emplace(bits, (uint32_t)firstRow.size());
+                if (inserted.second) firstRow.push_back((uint32_t)r);
+                groupOf[r] = inserted.first->second;
+            }
+        }
+        auto out = std::make_shared<TableObject>();
+        out->columns.push_back(key.gather(firstRow));
+        out->columns.push_back(aggregateColumn(values, &groupOf, firstRow.size(), agg));
+        out->columns.back().name = args.size() == 3 ? agg + "_" + values.name : "count";
+        out->rows = firstRow.size();
+        return out;
+    });
     return nullptr;
 }
-std::shared_ptr<ULangObject> FunctionObject::call(Interpreter& interpreter, const std::vector<std::shared_ptr<ULangObject>>& args) {
+struct CsvOptions {
+    char delimiter = ',';
+    bool header = true;
+    unsigned threads = 0; // 0: one per hardware thread
+};
+// Splits one CSV record starting at p into fields, returning the start of the next record. Unquoted
+// fields are views into the file; quoted fields with "" escapes are unescaped into `storage`. Field
+// ends are found 16 bytes at a time by comparing against the delimiter and '\n' together.
+const char* csvRecord(const char* p, const char* end, char delimiter, std::vector<std::string_view>& fields, std::deque<std::string>& storage) {
+    fields.clear();
+    while (true) {
+        if (p < end && *p == '"') {
+            const char* start = ++p;
+            std::string* unescaped = nullptr;
+            while (true) {
+                auto quote = (const char*)std::memchr(p, '"', (size_t)(end - p));
+                if (!quote) throw_runtime_error("read_csv: unterminated quoted field");
+                if (quote + 1 < end && quote[1] == '"') {
+                    if (!unescaped) { storage.emplace_back(); unescaped = &storage.back(); }
+                    unescaped->append(p, (size_t)(quote + 1 - p));
+                    p = quote + 2;
+                    continue;
+                }
+                if (unescaped) { unescaped->append(p, (size_t)(quote - p)); fields.emplace_back(*unescaped); }
+                else fields.emplace_back(start, (size_t)(quote - start));
+                p = quote + 1;
+                break;
+            }
+        } else {
+            const char* start = p;
+#if defined(__SSE2__)
+            const __m128i delim = _mm_set1_epi8(delimiter), newline = _mm_set1_epi8('\n');
+            while (p + 16 <= end) {
+                __m128i block = _mm_loadu_si128((const __m128i*)p);
+                unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, delim), _mm_cmpeq_epi8(block, newline)));
+                if (mask) { p += __builtin_ctz(mask); break; }
+                p += 16;
+            }
+#endif
+            while (p < end && *p != delimiter && *p != '\n') ++p;
+            const char* stop = p;
+            if (stop > start && stop[-1] == '\r' && (p == end || *p == '\n')) --stop;
+            fields.emplace_back(start, (size_t)(stop - start));
+        }
+        if (p < end && *p == delimiter) { ++p; continue; }
+        if (p < end && *p == '\r') ++p;
+        if (p < end && *p == '\n') ++p;
+        return p;
+    }
+}
+TableColumn::Kind csvCellKind(std::string_view cell) {
+    int64_t i;
+    double d;
+    const char* end = cell.data() + cell.size();
+    auto ri = std::from_chars(cell.data(), end, i);
+    if (ri.ec == std::errc() && ri.ptr == end) return TableColumn::INT;
+    auto rd = std::from_chars(cell.data(), end, d);
+    if (rd.ec == std::errc() && rd.ptr == end) return TableColumn::FLOAT;
+    return TableColumn::STRING;
+}
+// read_csv: the file is mapped, column kinds are inferred from the first rows, and the body is cut
+// at line breaks into one chunk per thread. Rows are counted first so every column is allocated once
+// at full size and each thread writes its chunk's rows in place; strings are interned per chunk and
+// the dictionaries merged afterwards. A cell that does not fit its column's kind (say "n/a" in an
+// int column) widens the column and the parse is repeated, which can happen at most twice a column.
+std::shared_ptr<TableObject> readCsv(const std::string& path, const CsvOptions& options) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw_runtime_error("Could not read file: " + path);
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = (size_t)st.st_size;
+    const char* data = size ? (const char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (data == MAP_FAILED) throw_runtime_error("Could not map file: " + path);
+    struct Unmap { const char* data; size_t size; ~Unmap() { if (size) munmap((void*)data, size); } } unmap{data, size};
+    if (size) madvise((void*)data, size, MADV_SEQUENTIAL);
+    const char* p = data;
+    const char* end = data + size;
+    if (size >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+    auto table = std::make_shared<TableObject>();
+    std::vector<std::string_view> fields;
+    std::deque<std::string> storage;
+    while (p < end && (*p == '\n' || *p == '\r')) ++p;
+    if (p == end) return table;
+    const char* firstRecord = p;
+    const char* body = csvRecord(p, end, options.delimiter, fields, storage);
+    size_t width = fields.size();
+    for (size_t c = 0; c < width; ++c) {
+        TableColumn col;
+        col.name = options.header ? std::string(fields[c]) : "c" + std::to_string(c);
+        table->columns.push_back(std::move(col));
+    }
+    if (!options.header) body = firstRecord;
+    // Kinds from up to 1000 leading rows; an empty cell makes an int column float so it can hold NaN.
+    std::vector<int> kinds(width, -1);
+    std::vector<char> hasEmpty(width, 0);
+    const char* q = body;
+    for (int sampled = 0; sampled < 1000 && q < end; ++sampled) {
+        q = csvRecord(q, end, options.delimiter, fields, storage);
+        if (fields.size() == 1 && fields[0].empty()) continue;
+        for (size_t c = 0; c < width; ++c) {
+            if (c >= fields.size() || fields[c].empty()) { hasEmpty[c] = 1; continue; }
+            kinds[c] = std::max(kinds[c], (int)csvCellKind(fields[c]));
+        }
+    }
+    for (size_t c = 0; c < width; ++c) {
+        auto kind = kinds[c] < 0 ? TableColumn::STRING : (TableColumn::Kind)kinds[c];
+        if (kind == TableColumn::INT && hasEmpty[c]) kind = TableColumn::FLOAT;
+        table->columns[c].kind = kind;
+    }
+    // Chunks of at least 1 MiB, cut just after a line break.
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t bodySize = (size_t)(end - body);
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, bodySize >> 20));
+    std::vector<const char*> bounds = {body};
+    for (size_t i = 1; i < chunkCount; ++i) {
+        const char* cut = std::max(bounds.back(), body + bodySize * i / chunkCount);
+        auto nl = (const char*)std::memchr(cut, '\n', (size_t)(end - cut));
+        if (!nl) break;
+        bounds.push_back(nl + 1);
+    }
+    bounds.push_back(end);
+    chunkCount = bounds.size() - 1;
+    // Per chunk: an upper bound on its rows (its line breaks) and whether its quotes balance. A chunk
+    // that starts inside a quoted field (a line break within quotes) means the cuts are wrong, so the
+    // body is then parsed as a single chunk.
+    std::vector<size_t> capacity(chunkCount), quotes(chunkCount);
+    auto parallel = [&](size_t n, const std::function<void(size_t)>& work) {
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < n; ++i) pool.emplace_back(work, i);
+        if (n) work(0);
+        for (auto& t : pool) t.join();
+    };
+    parallel(chunkCount, [&](size_t i) {
+        std::string_view chunk(bounds[i], (size_t)(bounds[i + 1] - bounds[i]));
+        capacity[i] = countBytes(chunk, "\n") + (!chunk.empty() && chunk.back() != '\n');
+        quotes[i] = countBytes(chunk, "\"");
+    });
+    size_t parity = 0;
+    bool split = true;
+    for (size_t i = 0; i < chunkCount; ++i) { if (parity & 1) split = false; parity += quotes[i]; }
+    if (!split) {
+        size_t total = 0;
+        for (auto c : capacity) total += c;
+        bounds = {body, end};
+        capacity = {total};
+        chunkCount = 1;
+    }
+    std::vector<size_t> offset(chunkCount + 1, 0);
+    for (size_t i = 0; i < chunkCount; ++i) offset[i + 1] = offset[i] + capacity[i];
+    if (offset[chunkCount] > UINT32_MAX) throw_runtime_error("read_csv: more than 4294967295 rows");
+    struct ChunkResult {
+        size_t rows = 0;
+        std::vector<int> widen;                                          // kind a column needs, or -1
+        std::vector<std::vector<std::string_view>> strings;              // per column: local code -> text
+        std::deque<std::string> storage;
+        std::string error;
+    };
+    std::vector<ChunkResult> results(chunkCount);
+    while (true) {
+        for (auto& col : table->columns) col.resize(offset[chunkCount]);
+        parallel(chunkCount, [&](size_t i) {
+            ChunkResult& res = results[i];
+            res = ChunkResult();
+            res.widen.assign(width, -1);
+            res.strings.resize(width);
+            std::vector<std::unordered_map<std::string_view, uint32_t>> local(width);
+            std::vector<std::string_view> cells;
+            size_t row = offset[i];
+            const char* at = bounds[i];
+            try {
+                while (at < bounds[i + 1]) {
+                    at = csvRecord(at, bounds[i + 1], options.delimiter, cells, res.storage);
+                    if (cells.size() == 1 && cells[0].empty()) continue;
+                    if (cells.size() > width) {
+                        res.error = "read_csv: a row has " + std::to_string(cells.size()) + " fields, the header " + std::to_string(width);
+                        return;
+                    }
+                    for (size_t c = 0; c < width; ++c) {
+                        TableColumn& col = table->columns[c];
+                        std::string_view cell = c < cells.size() ? cells[c] : std::string_view();
+                        const char* cellEnd = cell.data() + cell.size();
+                        if (col.kind == TableColumn::STRING) {
+                            auto found = local[c].find(cell);
+                            if (found == local[c].end()) {
+                                found = local[c].emplace(cell, (uint32_t)res.strings[c].size()).first;
+                                res.strings[c].push_back(cell);
+                            }
+                            col.codes[row] = found->second;
+                        } else if (col.kind == TableColumn::INT) {
+                            auto r = std::from_chars(cell.data(), cellEnd, col.ints[row]);
+                            if (cell.empty() || r.ec != std::errc() || r.ptr != cellEnd)
+                                res.widen[c] = std::max(res.widen[c], cell.empty() ? (int)TableColumn::FLOAT : (int)csvCellKind(cell));
+                        } else if (cell.empty()) {
+                            col.floats[row] = std::nan("");
+                        } else {
+                            auto r = std::from_chars(cell.data(), cellEnd, col.floats[row]);
+                            if (r.ec != std::errc() || r.ptr != cellEnd) res.widen[c] = TableColumn::STRING;
+                        }
+                    }
+                    ++row;
+                }
+            } catch (const ULangError& e) {
+                res.error = e.what();
+            }
+            res.rows = row - offset[i];
+        });
+        bool widened = false;
+        for (auto& res : results) {
+            if (!res.error.empty()) throw_runtime_error(res.error);
+            for (size_t c = 0; c < width; ++c) {
+                if (res.widen[c] > (int)table->columns[c].kind) {
+                    auto& col = table->columns[c];
+                    col.ints = {}; col.floats = {}; col.codes = {};
+                    col.kind = (TableColumn::Kind)res.widen[c];
+                    widened = true;
+                }
+            }
+        }
+        if (!widened) break;
+    }
+    // Merge the chunks' dictionaries, rewrite local codes to pool codes, and close the gaps left by
+    // blank lines (rows were allocated per line break).
+    size_t rows = 0;
+    for (size_t c = 0; c < width; ++c)
+        if (table->columns[c].kind == TableColumn::STRING) table->columns[c].pool = std::make_shared<StringPool>();
+    for (size_t i = 0; i < chunkCount; ++i) {
+        auto& res = results[i];
+        for (size_t c = 0; c < width; ++c) {
+            TableColumn& col = table->columns[c];
+            if (col.kind == TableColumn::STRING) {
+                std::vector<uint32_t> remap(res.strings[c].size());
+                for (size_t k = 0; k < remap.size(); ++k) remap[k] = col.pool->intern(res.strings[c][k]);
+                for (size_t r = 0; r < res.rows; ++r) col.codes[rows + r] = remap[col.codes[offset[i] + r]];
+            } else if (rows != offset[i]) {
+                if (col.kind == TableColumn::INT) std::memmove(&col.ints[rows], &col.ints[offset[i]], res.rows * sizeof(int64_t));
+                else std::memmove(&col.floats[rows], &col.floats[offset[i]], res.rows * sizeof(double));
+            }
+        }
+        rows += res.rows;
+    }
+    for (auto& col : table->columns) { col.resize(rows); col.ints.shrink_to_fit(); col.floats.shrink_to_fit(); col.codes.shrink_to_fit(); }
+    table->rows = rows;
+    return table;
+}
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+bool MemoCache::hashArgs(const ArgList& args, uint64_t& out) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ args.size();
+    for (auto& a : args) {
+        uint64_t part;
+        switch (a->type) {
+            case ULangObject::NUMBER: {
+                double d = a->toDouble();
+                if (d == 0.0) d = 0.0; // -0 and +0 compare equal, so they must hash equal
+                std::memcpy(&part, &d, sizeof(part));
+                break;
+            }
+            case ULangObject::STRING: part = std::hash<std::string_view>()(static_cast<StringObject*>(a.get())->view()); break;
+            case ULangObject::BOOLEAN: part = a->isTruthy() ? 1 : 0; break;
+            case ULangObject::VAL_VOID: part = 0; break;
+            default: return false;
+        }
+        h = mix64(h ^ (part + a->type));
+    }
+    out = h;
+    return true;
+}
+bool MemoCache::sameValue(const std::shared_ptr<ULangObject>& a, const std::shared_ptr<ULangObject>& b) {
+    if (a->type != b->type) return false;
+    if (a->type == ULangObject::STRING) return static_cast<StringObject*>(a.get())->view() == static_cast<StringObject*>(b.get())->view();
+    if (a->type == ULangObject::VAL_VOID) return true;
+    if (a->type == ULangObject::NUMBER) {
+        auto x = static_cast<NumberObject*>(a.get());
+        auto y = static_cast<NumberObject*>(b.get());
+        if (x->isInt && y->isInt) return x->ivalue == y->ivalue;
+    }
+    return a->toDouble() == b->toDouble();
+}
+std::shared_ptr<ULangObject> FunctionObject::invoke(Interpreter& interpreter, const ArgList& args, const std::shared_ptr<InstanceObject>& self) {
+    if (isAsync) return interpreter.loop.spawn(std::static_pointer_cast<FunctionObject>(shared_from_this()), self, args);
+    return execute(interpreter, args, self);
+}
+std::shared_ptr<ULangObject> FunctionObject::execute(Interpreter& interpreter, const ArgList& args, const std::shared_ptr<InstanceObject>& self) {
+    uint64_t memoHash = 0;
+    bool memoMiss = false;
+    std::vector<std::shared_ptr<ULangObject>> memoArgs;
+    if (memo) {
+        if (!MemoCache::hashArgs(args, memoHash)) {
+            memo->bypassed++;
+        } else if (auto cached = memo->find(memoHash, args)) {
+            memo->hits++;
+            return cached;
+        } else {
+            memo->misses++;
+            memoMiss = true;
+            // args points into the value stack, which the body may reallocate.
+            memoArgs.assign(args.begin(), args.end());
+        }
+    }
+    bool traced = interpreter.tracer.active();
+    uint64_t traceStart = traced ? interpreter.tracer.nowUs() : 0;
+    ensureParsed(interpreter);
+    interpreter.step();
+    interpreter.enterCall();
+    ModuleObject* savedModule = interpreter.module;
+    if (module) interpreter.module = module;
     interpreter.pushEnv();
-    if (receiver) interpreter.enterInstanceContext(receiver);
+    std::shared_ptr<InstanceObject> savedInstance = interpreter.current_instance;
+    if (self) interpreter.current_instance = self;
     for (size_t i = 0; i < params.size(); ++i) {
         if (i < args.size()) interpreter.define(params[i], args[i]);
     }
     std::shared_ptr<ULangObject> result = VOID_INSTANCE;
+    // Keeps a tail-called function alive while its body runs in this frame.
+    std::shared_ptr<FunctionObject> tailTarget;
+    FunctionObject* current = this;
     try {
-        result = interpreter.executeBlock(body);
-    } catch (std::shared_ptr<ULangObject> retVal) {
-        result = retVal;
+        while (true) {
+            result = interpreter.executeBlock(current->body);
+            if (interpreter.returning) {
+                result = std::move(interpreter.returnValue);
+                interpreter.returning = false;
+            }
+            if (!interpreter.tailCall.pending) break;
+            // `return f(...)` in tail position: rebind this frame instead of nesting a new call.
+            auto& tail = interpreter.tailCall;
+            tail.pending = false;
+            // The callee would see this frame through dynamic scoping, so it is only dropped when the
+            // callee's arguments rebind every name in it; otherwise the call nests as usual.
+            Frame& frame = interpreter.frames[interpreter.depth - 1];
+            auto& calleeParams = tail.fn->params;
+            size_t bound = std::min(calleeParams.size(), tail.args.size());
+            bool reusable = std::all_of(frame.vars.begin(), frame.vars.end(), [&](const auto& v) {
+                return std::find(calleeParams.begin(), calleeParams.begin() + (long)bound, *v.first) != calleeParams.begin() + (long)bound;
+            });
+            if (!reusable) {
+                auto fn = std::move(tail.fn);
+                auto self = std::move(tail.self);
+                std::vector<std::shared_ptr<ULangObject>> args;
+                args.swap(tail.args);
+                result = fn->invoke(interpreter, ArgList(args), self);
+                break;
+            }
+            interpreter.step();
+            tailTarget = std::move(tail.fn);
+            current = tailTarget.get();
+            current->ensureParsed(interpreter);
+            if (current->module) interpreter.module = current->module;
+            frame.vars.clear();
+            frame.visible = interpreter.depth > 1 ? interpreter.frames[interpreter.depth - 2].visible : 0;
+            if (tail.self) interpreter.current_instance = std::move(tail.self);
+            for (size_t i = 0; i < current->params.size() && i < tail.args.size(); ++i) {
+                interpreter.define(current->params[i], tail.args[i]);
+            }
+            tail.args.clear();
+        }
     } catch (...) {
-        if (receiver) interpreter.exitInstanceContext();
+        interpreter.tailCall.pending = false;
+        interpreter.current_instance = savedInstance;
+        interpreter.module = savedModule;
         interpreter.popEnv();
+        interpreter.exitCall();
         throw;
     }
-    if (receiver) interpreter.exitInstanceContext();
+    interpreter.current_instance = savedInstance;
+    interpreter.module = savedModule;
     interpreter.popEnv();
+    interpreter.exitCall();
+    if (traced) interpreter.tracer.call(name, traceStart, interpreter.depth, interpreter.loop.current ? interpreter.loop.current->id : 1);
+    if (memoMiss) memo->insert(memoHash, std::move(memoArgs), result);
     return result;
 }
+EventLoop* EventLoop::active = nullptr;
+EventLoop::~EventLoop() {
+    while (!transfers.empty()) endTransfer(transfers.begin()->first);
+    if (multi) curl_multi_cleanup(multi);
+}
+void EventLoop::schedule(const std::shared_ptr<TaskObject>& task) {
+    if (task->queued) return;
+    task->queued = true;
+    ready.push_back(task);
+}
+void EventLoop::whenDone(TaskObject& task, std::function<void()> callback) {
+    if (task.finished()) callback();
+    else task.onDone.push_back(std::move(callback));
+}
+void EventLoop::finish(TaskObject& task) {
+    task.fn = nullptr;
+    task.self = nullptr;
+    task.args.clear();
+    task.children.clear();
+    task.onCancel = nullptr;
+    auto callbacks = std::move(task.onDone);
+    task.onDone.clear();
+    for (auto& callback : callbacks) callback();
+}
+void EventLoop::fail(TaskObject& task, const std::string& type, const std::string& message) {
+    task.state = type == "CancelledError" ? TaskObject::CANCELLED : TaskObject::FAILED;
+    task.errorType = type;
+    task.errorMessage = message;
+    finish(task);
+}
+std::shared_ptr<TaskObject> EventLoop::spawn(const std::shared_ptr<FunctionObject>& fn, const std::shared_ptr<InstanceObject>& self, const ArgList& args) {
+    auto task = std::make_shared<TaskObject>(fn->name.empty() ? "<async>" : fn->name);
+    task->fn = fn;
+    task->self = self;
+    task->args.assign(args.begin(), args.end());
+    task->coroutine = std::make_unique<TaskObject::Coroutine>();
+    task->id = ++spawned + 1;
+    interpreter.tracer.threadName(task->id, "task " + task->name);
+    schedule(task);
+    return task;
+}
+// First code run on a task's own stack; returning resumes the loop through uc_link.
+void EventLoop::entry() {
+    EventLoop& loop = *active;
+    TaskObject& task = *loop.current;
+    try {
+        task.result = task.fn->execute(loop.interpreter, ArgList(task.args), task.self);
+        task.state = TaskObject::DONE;
+        loop.finish(task);
+    } catch (ULangError& e) {
+        loop.fail(task, e.type, e.what());
+    } catch (std::exception& e) {
+        loop.fail(task, "Runtime", e.what());
+    }
+}
+void EventLoop::resume(const std::shared_ptr<TaskObject>& task) {
+    auto& co = *task->coroutine;
+    if (!co.stack) {
+        // Mapped on demand, so a few hundred idle tasks cost little more than their page tables.
+        void* mem = mmap(nullptr, TASK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (mem == MAP_FAILED) { fail(*task, "Runtime", "Cannot allocate a stack for task '" + task->name + "'"); return; }
+        co.stack = static_cast<char*>(mem);
+        co.stackSize = TASK_STACK_SIZE;
+        getcontext(&co.context);
+        co.context.uc_stack.ss_sp = co.stack;
+        co.context.uc_stack.ss_size = co.stackSize;
+        co.context.uc_link = &loopContext;
+        makecontext(&co.context, &EventLoop::entry, 0);
+        co.state.module = interpreter.module;
+        co.state.valueStack.reserve(256);
+        co.state.nativeStackBase = co.stack + co.stackSize;
+        co.state.nativeStackSize = co.stackSize;
+        task->state = TaskObject::RUNNING;
+    }
+    interpreter.swapState(co.state);
+    current = task.get();
+    active = this;
+    swapcontext(&loopContext, &co.context);
+    current = nullptr;
+    interpreter.swapState(co.state);
+    if (task->finished()) task->coroutine.reset();
+}
+std::shared_ptr<ULangObject> EventLoop::await(const std::shared_ptr<TaskObject>& task) {
+    TaskObject* self = current;
+    if (self == task.get()) throw_runtime_error("A task cannot await itself");
+    if (!self) {
+        if (!task->finished()) run(task.get());
+    } else {
+        if (!task->finished() && !self->cancelRequested) {
+            auto me = std::static_pointer_cast<TaskObject>(self->shared_from_this());
+            TaskObject* target = task.get();
+            whenDone(*task, [this, me, target]() { if (me->awaiting == target) schedule(me); });
+            self->awaiting = target;
+            swapcontext(&self->coroutine->context, &loopContext);
+            self->awaiting = nullptr;
+        }
+        if (self->cancelRequested) {
+            self->cancelRequested = false;
+            cancel(task);
+            throw ULangError("Task '" + self->name + "' was cancelled", "CancelledError", current_line, current_column);
+        }
+    }
+    if (task->state != TaskObject::DONE) throw ULangError(task->errorMessage, task->errorType, current_line, current_column);
+    return task->result;
+}
+bool EventLoop::cancel(const std::shared_ptr<TaskObject>& task) {
+    if (task->finished()) return false;
+    if (task->coroutine && task->coroutine->stack) {
+        // Already started: the CancelledError is raised inside it, at the await it is suspended on
+        // or the next one it reaches, so it can clean up or even catch it.
+        task->cancelRequested = true;
+        if (task->awaiting) {
+            task->awaiting = nullptr;
+            schedule(task);
+        }
+        return true;
+    }
+    if (task->onCancel) {
+        auto release = std::move(task->onCancel);
+        task->onCancel = nullptr;
+        release();
+    }
+    if (!task->finished()) fail(*task, "CancelledError", "Task '" + task->name + "' was cancelled");
+    return true;
+}
+std::shared_ptr<TaskObject> EventLoop::sleep(int64_t ms) {
+    auto task = std::make_shared<TaskObject>("sleep");
+    uint64_t deadline = timers.add(nowMs() + (uint64_t)std::max<int64_t>(ms, 0), task);
+    TaskObject* raw = task.get();
+    task->onCancel = [this, deadline, raw]() { timers.remove(deadline, raw); };
+    return task;
+}
+std::shared_ptr<TaskObject> EventLoop::http(const std::string& url, const std::shared_ptr<ULangObject>& body, const std::vector<std::string>& headers) {
+    if (!multi) multi = curl_multi_init();
+    CURL* handle = multi ? curl_easy_init() : nullptr;
+    if (!handle) throw_runtime_error("Failed to initialize cURL");
+    auto task = std::make_shared<TaskObject>(body ? "http_post" : "http_get");
+    auto transfer = std::make_unique<Transfer>();
+    transfer->task = task;
+    transfer->url = url;
+    transfer->id = ++transferCount;
+    transfer->startUs = interpreter.tracer.nowUs();
+    interpreter.tracer.asyncSpan('b', task->name + " " + url, "http", transfer->id, transfer->startUs);
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    std::string_view payload;
+    if (body && bytesOf(body, payload)) {
+        // POSTFIELDS is not copied by curl, so the transfer holds on to the body instead.
+        if (body->type == ULangObject::BYTES) {
+            transfer->bodyCopy.assign(payload.data(), payload.size());
+            payload = transfer->bodyCopy;
+        } else transfer->body = body;
+        curl_easy_setopt(handle, CURLOPT_POST, 1L);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, payload.data());
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)payload.size());
+    }
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &transfer->response);
+    for (auto& h : headers) transfer->headers = curl_slist_append(transfer->headers, h.c_str());
+    if (transfer->headers) curl_easy_setopt(handle, CURLOPT_HTTPHEADER, transfer->headers);
+    curl_multi_add_handle(multi, handle);
+    transfers[handle] = std::move(transfer);
+    task->onCancel = [this, handle]() { endTransfer(handle); };
+    return task;
+}
+std::unique_ptr<EventLoop::Transfer> EventLoop::endTransfer(CURL* handle) {
+    auto it = transfers.find(handle);
+    if (it == transfers.end()) return nullptr;
+    auto transfer = std::move(it->second);
+    transfers.erase(it);
+    curl_multi_remove_handle(multi, handle);
+    curl_easy_cleanup(handle);
+    curl_slist_free_all(transfer->headers);
+    transfer->headers = nullptr;
+    Tracer& tracer = interpreter.tracer;
+    uint64_t now = tracer.nowUs();
+    tracer.httpRequests++;
+    tracer.httpInFlightUs += now - transfer->startUs;
+    tracer.asyncSpan('e', transfer->task->name + " " + transfer->url, "http", transfer->id, now);
+    return transfer;
+}
+void EventLoop::pollTransfers(long timeoutMs) {
+    curl_multi_poll(multi, nullptr, 0, (int)timeoutMs, nullptr);
+    int running = 0;
+    curl_multi_perform(multi, &running);
+    int pending = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi, &pending)) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURLcode code = msg->data.result;
+        auto transfer = endTransfer(msg->easy_handle);
+        if (!transfer) continue;
+        TaskObject& task = *transfer->task;
+        if (code != CURLE_OK) {
+            fail(task, "Runtime", task.name + " failed: " + curl_easy_strerror(code));
+            continue;
+        }
+        task.result = std::make_shared<StringObject>(std::move(transfer->response));
+        task.state = TaskObject::DONE;
+        finish(task);
+    }
+}
+std::shared_ptr<TaskObject> EventLoop::gather(const std::vector<std::shared_ptr<TaskObject>>& tasks) {
+    auto group = std::make_shared<TaskObject>("gather");
+    group->children = tasks;
+    auto remaining = std::make_shared<size_t>(tasks.size());
+    TaskObject* raw = group.get();
+    group->onCancel = [this, raw]() {
+        auto children = raw->children;
+        for (auto& child : children) cancel(child);
+    };
+    auto complete = [this, group, remaining]() {
+        if (group->finished() || *remaining > 0) return;
+        std::vector<std::shared_ptr<ULangObject>> results;
+        for (auto& child : group->children) results.push_back(child->result);
+        group->result = std::make_shared<ListObject>(results);
+        group->state = TaskObject::DONE;
+        finish(*group);
+    };
+    for (auto& child : tasks) {
+        TaskObject* c = child.get();
+        whenDone(*child, [this, group, c, remaining, complete]() {
+            if (group->finished()) return;
+            if (c->state != TaskObject::DONE) {
+                // The first failure fails the gather and cancels the tasks still running.
+                auto siblings = group->children;
+                fail(*group, c->errorType, c->errorMessage);
+                for (auto& sibling : siblings) cancel(sibling);
+                return;
+            }
+            --*remaining;
+            complete();
+        });
+    }
+    complete();
+    return group;
+}
+void EventLoop::run(TaskObject* until) {
+    std::vector<std::shared_ptr<TaskObject>> due;
+    while (until ? !until->finished() : !ready.empty() || timers.count > 0 || !transfers.empty()) {
+        timers.advance(nowMs(), due);
+        bool fired = !due.empty();
+        for (auto& task : due) {
+            if (task->finished()) continue;
+            task->state = TaskObject::DONE;
+            finish(*task);
+        }
+        due.clear();
+        if (fired) continue;
+        if (!ready.empty()) {
+            auto task = std::move(ready.front());
+            ready.pop_front();
+            task->queued = false;
+            if (!task->finished()) resume(task);
+            continue;
+        }
+        long timeout = timers.nextTimeout(nowMs());
+        // A script's time limit also bounds how long it can sit waiting on timers and transfers.
+        long budget = interpreter.msUntilDeadline();
+        if (budget == 0) interpreter.checkLimits();
+        if (budget > 0 && (timeout > budget || (timeout < 0 && !transfers.empty()))) timeout = budget;
+        if (!transfers.empty()) pollTransfers(timeout < 0 ? 1000 : timeout);
+        else if (timeout > 0) std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        else if (timeout < 0) throw_runtime_error("Awaited task '" + until->name + "' can never finish: no other work is pending");
+    }
+}
 std::shared_ptr<ULangObject> Interpreter::executeBlock(const std::vector<std::shared_ptr<ASTNode>>& statements) {
     std::shared_ptr<ULangObject> result = VOID_INSTANCE;
-    for (const auto& stmt : statements) {
-        result = stmt->evaluate(*this);
+    const ASTNode* stmt = nullptr;
+    try {
+        for (const auto& s : statements) {
+            stmt = s.get();
+            result = s->evaluate(*this);
+            if (returning) break;
+        }
+    } catch (ULangError& e) {
+        if (!e.located && stmt->line > 0) {
+            e.line = stmt->line;
+            e.column = stmt->column;
+            e.located = true;
+        }
+        throw;
+    } catch (const HeapLimitExceeded&) {
+        throw_heap_limit(stmt->line, stmt->column);
     }
     return result;
 }
 void Interpreter::loadLibs() {
-    define("output", std::make_shared<BuiltinFunction>("output", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) {
-        for (auto& arg : args) std::cout << arg->toString() << " ";
-        std::cout << std::endl;
+    define("output", std::make_shared<BuiltinFunction>("output", [](Interpreter& interpreter, const ArgList& args) {
+        std::string& line = interpreter.outputBuffer;
+        line.clear();
+        for (auto& arg : args) {
+            arg->appendTo(line);
+            line += ' ';
+        }
+        line += '\n';
+        std::cout.write(line.data(), (std::streamsize)line.size());
+        if (interpreter.flushEachLine) std::cout.flush();
         return VOID_INSTANCE;
     }));
-    define("len", std::make_shared<BuiltinFunction>("len", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) {
+    define("len", std::make_shared<BuiltinFunction>("len", [](Interpreter&, const ArgList& args) {
         if (args.size() != 1) throw_runtime_error("len expects 1 argument");
-        if (args[0]->type == ULangObject::LIST) return std::make_shared<NumberObject>((double)std::static_pointer_cast<ListObject>(args[0])->elements.size());
-        if (args[0]->type == ULangObject::STRING) return std::make_shared<NumberObject>((double)std::static_pointer_cast<StringObject>(args[0])->value.length());
-        return std::make_shared<NumberObject>(0.0);
+        if (args[0]->type == ULangObject::LIST) return NumberObject::integer((int64_t)std::static_pointer_cast<ListObject>(args[0])->elements.size());
+        if (args[0]->type == ULangObject::STRING) return NumberObject::integer((int64_t)static_cast<StringObject*>(args[0].get())->size());
+        if (args[0]->type == ULangObject::BYTES) return NumberObject::integer((int64_t)static_cast<BytesObject*>(args[0].get())->data.size());
+        if (args[0]->type == ULangObject::TABLE) return NumberObject::integer((int64_t)static_cast<TableObject*>(args[0].get())->rows);
+        return NumberObject::integer(0);
+    }));
+    define("bytes", std::make_shared<BuiltinFunction>("bytes", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1) throw_runtime_error("bytes expects 1 argument: a size, a string, bytes or a list of bytes");
+        std::string_view raw;
+        int64_t n;
+        if (bytesOf(args[0], raw)) return std::make_shared<BytesObject>(std::string(raw));
+        if (args[0]->type == ULangObject::NUMBER && static_cast<NumberObject*>(args[0].get())->asInteger(n) && n >= 0) return std::make_shared<BytesObject>(std::string((size_t)n, '\0'));
+        if (args[0]->type != ULangObject::LIST) throw_runtime_error("bytes expects a size, a string, bytes or a list of bytes");
+        std::string data;
+        for (auto& e : static_cast<ListObject*>(args[0].get())->elements) {
+            int64_t byte;
+            if (e->type != ULangObject::NUMBER || !static_cast<NumberObject*>(e.get())->asInteger(byte) || byte < 0 || byte > 255)
+                throw_runtime_error("A byte must be an integer from 0 to 255");
+            data.push_back((char)byte);
+        }
+        return std::make_shared<BytesObject>(std::move(data));
+    }));
+    define("string", std::make_shared<BuiltinFunction>("string", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1) throw_runtime_error("string expects 1 argument");
+        if (args[0]->type == ULangObject::STRING) return args[0];
+        if (args[0]->type == ULangObject::BYTES) return std::make_shared<StringObject>(static_cast<BytesObject*>(args[0].get())->data);
+        return std::make_shared<StringObject>(args[0]->toString());
+    }));
+    // slice(x, start[, end]): strings give an O(1) view sharing x's buffer; bytes and lists are copied.
+    define("slice", std::make_shared<BuiltinFunction>("slice", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() < 2 || args.size() > 3) throw_runtime_error("slice expects 2 or 3 arguments: VALUE, START, [END]");
+        size_t size;
+        if (args[0]->type == ULangObject::STRING) size = static_cast<StringObject*>(args[0].get())->size();
+        else if (args[0]->type == ULangObject::BYTES) size = static_cast<BytesObject*>(args[0].get())->data.size();
+        else if (args[0]->type == ULangObject::LIST) size = static_cast<ListObject*>(args[0].get())->elements.size();
+        else throw_runtime_error("slice expects a string, bytes or a list");
+        int64_t start, end = (int64_t)size;
+        if (args[1]->type != ULangObject::NUMBER || !static_cast<NumberObject*>(args[1].get())->asInteger(start) ||
+            (args.size() == 3 && (args[2]->type != ULangObject::NUMBER || !static_cast<NumberObject*>(args[2].get())->asInteger(end))))
+            throw_runtime_error("slice bounds must be integers");
+        start = std::clamp<int64_t>(start, 0, (int64_t)size);
+        end = std::clamp<int64_t>(end, start, (int64_t)size);
+        if (args[0]->type == ULangObject::STRING) return StringObject::slice(std::static_pointer_cast<StringObject>(args[0]), (size_t)start, (size_t)(end - start));
+        if (args[0]->type == ULangObject::BYTES) return std::make_shared<BytesObject>(static_cast<BytesObject*>(args[0].get())->data.substr((size_t)start, (size_t)(end - start)));
+        auto& elements = static_cast<ListObject*>(args[0].get())->elements;
+        return std::make_shared<ListObject>(std::vector<std::shared_ptr<ULangObject>>(elements.begin() + start, elements.begin() + end));
+    }));
+    define("read_file", std::make_shared<BuiltinFunction>("read_file", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::STRING) throw_runtime_error("read_file expects 1 argument: PATH (string)");
+        std::string path = static_cast<StringObject*>(args[0].get())->str(), data;
+        if (!readWholeFile(path, data)) throw_runtime_error("Could not read file: " + path);
+        return std::make_shared<StringObject>(std::move(data));
     }));
-    define("floor", std::make_shared<BuiltinFunction>("floor", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) {
+    define("read_bytes", std::make_shared<BuiltinFunction>("read_bytes", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::STRING) throw_runtime_error("read_bytes expects 1 argument: PATH (string)");
+        std::string path = static_cast<StringObject*>(args[0].get())->str(), data;
+        if (!readWholeFile(path, data)) throw_runtime_error("Could not read file: " + path);
+        return std::make_shared<BytesObject>(std::move(data));
+    }));
+    define("write_file", std::make_shared<BuiltinFunction>("write_file", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        std::string_view data;
+        if (args.size() != 2 || args[0]->type != ULangObject::STRING || !bytesOf(args[1], data))
+            throw_runtime_error("write_file expects 2 arguments: PATH (string), DATA (string or bytes)");
+        std::string path = static_cast<StringObject*>(args[0].get())->str();
+        std::ofstream file(path, std::ios::binary);
+        if (!file.write(data.data(), (std::streamsize)data.size())) throw_runtime_error("Could not write file: " + path);
+        return VOID_INSTANCE;
+    }));
+    // read_csv(path, [options]); options is a list of [name, value] pairs: delimiter (one character),
+    // header (false when the first line is data) and threads (0 for one per core).
+    define("read_csv", std::make_shared<BuiltinFunction>("read_csv", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.empty() || args.size() > 2 || args[0]->type != ULangObject::STRING || (args.size() == 2 && args[1]->type != ULangObject::LIST))
+            throw_runtime_error("read_csv expects PATH (string) and optionally OPTIONS (list of [name, value] pairs)");
+        CsvOptions options;
+        if (args.size() == 2) {
+            for (auto& pair : static_cast<ListObject*>(args[1].get())->elements) {
+                auto list = pair->type == ULangObject::LIST ? static_cast<ListObject*>(pair.get()) : nullptr;
+                if (!list || list->elements.size() != 2 || list->elements[0]->type != ULangObject::STRING)
+                    throw_runtime_error("read_csv options must be [name, value] pairs");
+                std::string key = list->elements[0]->toString();
+                auto& value = list->elements[1];
+                if (key == "delimiter") {
+                    if (value->type != ULangObject::STRING || static_cast<StringObject*>(value.get())->size() != 1) throw_runtime_error("read_csv delimiter must be one character");
+                    options.delimiter = static_cast<StringObject*>(value.get())->view()[0];
+                } else if (key == "header") options.header = value->isTruthy();
+                else if (key == "threads") options.threads = (unsigned)std::clamp<int64_t>(intArg(value, "read_csv"), 0, 256);
+                else throw_runtime_error("Unknown read_csv option '" + key + "'; use delimiter, header or threads");
+            }
+        }
+        return readCsv(static_cast<StringObject*>(args[0].get())->str(), options);
+    }));
+    define("sha256", std::make_shared<BuiltinFunction>("sha256", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        std::string_view data;
+        if (args.size() != 1 || !bytesOf(args[0], data)) throw_runtime_error("sha256 expects 1 argument: DATA (string or bytes)");
+        return std::make_shared<StringObject>(sha256Hex(data));
+    }));
+    define("alloc_count", std::make_shared<BuiltinFunction>("alloc_count", [](Interpreter&, const ArgList&) {
+        return NumberObject::integer((int64_t)heap_allocations);
+    }));
+    define("memo", std::make_shared<BuiltinFunction>("memo", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.empty() || args.size() > 3 || args[0]->type != ULangObject::FUNCTION)
+            throw_runtime_error("memo expects a function, an optional cache size and an optional purity flag");
+        auto fn = std::static_pointer_cast<FunctionObject>(args[0]);
+        auto wrapped = std::make_shared<FunctionObject>(fn->params, fn->body, fn->receiver);
+        wrapped->name = fn->name;
+        wrapped->isAsync = fn->isAsync;
+        wrapped->module = fn->module;
+        wrapped->lazy = fn->lazy;
+        size_t capacity = 4096;
+        if (args.size() > 1) {
+            capacity = args[1]->type == ULangObject::NUMBER ? memoCapacityOf(args[1]->toDouble()) : 0;
+            if (!capacity) throw_runtime_error("memo cache size must be a whole number from 1 to 4294967296");
+        }
+        interpreter.memoize(wrapped, capacity, args.size() > 2 && args[2]->isTruthy());
+        return wrapped;
+    }));
+    define("memo_stats", std::make_shared<BuiltinFunction>("memo_stats", [](Interpreter&, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::FUNCTION || !std::static_pointer_cast<FunctionObject>(args[0])->memo)
+            throw_runtime_error("memo_stats expects a memoised function");
+        auto& cache = *std::static_pointer_cast<FunctionObject>(args[0])->memo;
+        std::vector<std::shared_ptr<ULangObject>> stats = {
+            NumberObject::integer((int64_t)cache.hits),
+            NumberObject::integer((int64_t)cache.misses),
+            NumberObject::integer((int64_t)cache.lru.size()),
+            NumberObject::integer((int64_t)cache.evictions),
+        };
+        return std::make_shared<ListObject>(stats);
+    }));
+    define("floor", std::make_shared<BuiltinFunction>("floor", [](Interpreter&, const ArgList& args) {
         if (args.empty() || args[0]->type != ULangObject::NUMBER) throw_runtime_error("floor expects number");
-        return std::make_shared<NumberObject>(std::floor(std::static_pointer_cast<NumberObject>(args[0])->value));
+        auto n = std::static_pointer_cast<NumberObject>(args[0]);
+        if (n->isInt) return n;
+        auto floored = std::make_shared<NumberObject>(std::floor(n->value));
+        int64_t exact;
+        return floored->asInteger(exact) ? NumberObject::integer(exact) : floored;
     }));
-    define("pow", std::make_shared<BuiltinFunction>("pow", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) {
+    define("pow", std::make_shared<BuiltinFunction>("pow", [](Interpreter&, const ArgList& args) {
         if (args.size() != 2) throw_runtime_error("pow expects 2 arguments");
+        if (args[0]->type == ULangObject::NUMBER && args[1]->type == ULangObject::NUMBER) {
+            auto base = std::static_pointer_cast<NumberObject>(args[0]);
+            auto exponent = std::static_pointer_cast<NumberObject>(args[1]);
+            int64_t result;
+            if (base->isInt && exponent->isInt && integerPow(base->ivalue, exponent->ivalue, result)) return NumberObject::integer(result);
+        }
         return std::make_shared<NumberObject>(std::pow(args[0]->toDouble(), args[1]->toDouble()));
     }));
-    define("drawGraph", std::make_shared<BuiltinFunction>("drawGraph", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) {
+    define("drawGraph", std::make_shared<BuiltinFunction>("drawGraph", [](Interpreter&, const ArgList& args) {
         if (args.empty() || args[0]->type != ULangObject::LIST) throw_runtime_error("drawGraph expects a list");
         auto list = std::static_pointer_cast<ListObject>(args[0]);
         std::cout << "\n--- GRAPH ---\n";
@@ -452,11 +2926,11 @@ void Interpreter::loadLibs() {
         }
         return VOID_INSTANCE;
     }));
-    define("http_post", std::make_shared<BuiltinFunction>("http_post", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) -> std::shared_ptr<ULangObject> {
-        if (args.size() != 3 || args[0]->type != ULangObject::STRING || args[1]->type != ULangObject::STRING || args[2]->type != ULangObject::LIST)
-            throw_runtime_error("http_post expects 3 arguments: URL (string), BODY (string), HEADERS (list)");
-        std::string url = std::static_pointer_cast<StringObject>(args[0])->value;
-        std::string body = std::static_pointer_cast<StringObject>(args[1])->value;
+    define("http_post", std::make_shared<BuiltinFunction>("http_post", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        std::string_view body;
+        if (args.size() != 3 || args[0]->type != ULangObject::STRING || !bytesOf(args[1], body) || args[2]->type != ULangObject::LIST)
+            throw_runtime_error("http_post expects 3 arguments: URL (string), BODY (string or bytes), HEADERS (list)");
+        std::string url = static_cast<StringObject*>(args[0].get())->str();
         auto headerList = std::static_pointer_cast<ListObject>(args[2]);
         std::string response_buffer;
         CURL* curl = curl_easy_init();
@@ -464,58 +2938,117 @@ void Interpreter::loadLibs() {
         if (curl) {
             curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
             curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+            // Sent straight from the argument's buffer; curl does not copy POSTFIELDS.
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body.size());
             curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
             curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_buffer);
             for (auto& headerObj : headerList->elements) {
                 if (headerObj->type == ULangObject::STRING) {
-                    headers = curl_slist_append(headers, std::static_pointer_cast<StringObject>(headerObj)->value.c_str());
+                    headers = curl_slist_append(headers, static_cast<StringObject*>(headerObj.get())->str().c_str());
                 }
             }
             curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            uint64_t started = interpreter.tracer.nowUs();
             CURLcode res = curl_easy_perform(curl);
+            interpreter.tracer.blockingHttp("http_post " + url, started);
             curl_slist_free_all(headers);
             curl_easy_cleanup(curl);
             if (res != CURLE_OK) throw_runtime_error("http_post failed: " + std::string(curl_easy_strerror(res)));
-            return std::make_shared<StringObject>(response_buffer);
+            return std::make_shared<StringObject>(std::move(response_buffer));
         }
         throw_runtime_error("Failed to initialize cURL");
         return VOID_INSTANCE;
     }));
     
-    define("http_get", std::make_shared<BuiltinFunction>("http_get", [](Interpreter&, const std::vector<std::shared_ptr<ULangObject>>& args) -> std::shared_ptr<ULangObject> {
+    define("http_get", std::make_shared<BuiltinFunction>("http_get", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
         if (args.size() != 1 || args[0]->type != ULangObject::STRING) throw_runtime_error("http_get expects 1 string argument (URL)");
-        std::string url = std::static_pointer_cast<StringObject>(args[0])->value;
+        std::string url = static_cast<StringObject*>(args[0].get())->str();
         std::string response_buffer;
         CURL* curl = curl_easy_init();
         if (curl) {
             curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
             curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
             curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_buffer);
+            uint64_t started = interpreter.tracer.nowUs();
             CURLcode res = curl_easy_perform(curl);
+            interpreter.tracer.blockingHttp("http_get " + url, started);
             curl_easy_cleanup(curl);
             if (res != CURLE_OK) throw_runtime_error("http_get failed: " + std::string(curl_easy_strerror(res)));
-            return std::make_shared<StringObject>(response_buffer);
+            return std::make_shared<StringObject>(std::move(response_buffer));
         }
         throw_runtime_error("Failed to initialize cURL");
         return VOID_INSTANCE;
     }));
+    define("http_get_async", std::make_shared<BuiltinFunction>("http_get_async", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::STRING) throw_runtime_error("http_get_async expects 1 string argument (URL)");
+        return interpreter.loop.http(static_cast<StringObject*>(args[0].get())->str(), nullptr, {});
+    }));
+    define("http_post_async", std::make_shared<BuiltinFunction>("http_post_async", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        std::string_view body;
+        if (args.size() != 3 || args[0]->type != ULangObject::STRING || !bytesOf(args[1], body) || args[2]->type != ULangObject::LIST)
+            throw_runtime_error("http_post_async expects 3 arguments: URL (string), BODY (string or bytes), HEADERS (list)");
+        std::vector<std::string> headers;
+        for (auto& h : std::static_pointer_cast<ListObject>(args[2])->elements) {
+            if (h->type == ULangObject::STRING) headers.push_back(static_cast<StringObject*>(h.get())->str());
+        }
+        return interpreter.loop.http(static_cast<StringObject*>(args[0].get())->str(), args[1], headers);
+    }));
+    define("sleep", std::make_shared<BuiltinFunction>("sleep", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::NUMBER) throw_runtime_error("sleep expects a number of milliseconds");
+        return interpreter.loop.sleep((int64_t)args[0]->toDouble());
+    }));
+    // gather(t1, t2, ...) or gather([t1, t2, ...]); values that are not tasks are passed through as results.
+    define("gather", std::make_shared<BuiltinFunction>("gather", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        std::vector<std::shared_ptr<ULangObject>> items(args.begin(), args.end());
+        if (items.size() == 1 && items[0]->type == ULangObject::LIST) items = std::static_pointer_cast<ListObject>(items[0])->elements;
+        std::vector<std::shared_ptr<TaskObject>> tasks;
+        for (auto& item : items) {
+            if (item->type == ULangObject::TASK) { tasks.push_back(std::static_pointer_cast<TaskObject>(item)); continue; }
+            auto done = std::make_shared<TaskObject>("value");
+            done->result = item;
+            done->state = TaskObject::DONE;
+            tasks.push_back(done);
+        }
+        return interpreter.loop.gather(tasks);
+    }));
+    define("cancel", std::make_shared<BuiltinFunction>("cancel", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::TASK) throw_runtime_error("cancel expects a task");
+        return std::make_shared<BooleanObject>(interpreter.loop.cancel(std::static_pointer_cast<TaskObject>(args[0])));
+    }));
+    // end = trace_span("name") opens a span; calling end() closes it and returns its length in milliseconds.
+    define("trace_span", std::make_shared<BuiltinFunction>("trace_span", [](Interpreter& interpreter, const ArgList& args) -> std::shared_ptr<ULangObject> {
+        if (args.size() != 1 || args[0]->type != ULangObject::STRING) throw_runtime_error("trace_span expects a name (string)");
+        std::string name = static_cast<StringObject*>(args[0].get())->str();
+        uint64_t started = interpreter.tracer.nowUs();
+        uint64_t tid = interpreter.loop.current ? interpreter.loop.current->id : 1;
+        return std::make_shared<BuiltinFunction>("end", [name, started, tid](Interpreter& interpreter, const ArgList&) {
+            interpreter.tracer.span(name, "script", started, tid);
+            return std::make_shared<NumberObject>((interpreter.tracer.nowUs() - started) / 1000.0);
+        });
+    }));
 }
-class NumberNode : public ASTNode {
-    double value;
+// Literals and folded subtrees share one immutable object instead of allocating on every evaluation.
+class ConstantNode : public ASTNode {
 public:
-    NumberNode(double v) : value(v) {}
+    std::shared_ptr<ULangObject> value;
+    ConstantNode(std::shared_ptr<ULangObject> v) : value(v) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
-        return std::make_shared<NumberObject>(value);
+        return value;
+    }
+    std::string describe() const override {
+        if (value->type == ULangObject::STRING) return "Constant \"" + value->toString() + "\"";
+        return "Constant " + value->toString();
     }
 };
-class StringNode : public ASTNode {
-    std::string value;
+class NumberNode : public ConstantNode {
 public:
-    StringNode(std::string v) : value(v) {}
-    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
-        return std::make_shared<StringObject>(value);
-    }
+    NumberNode(double v) : ConstantNode(std::make_shared<NumberObject>(v)) {}
+    NumberNode(std::shared_ptr<NumberObject> n) : ConstantNode(n) {}
+};
+class StringNode : public ConstantNode {
+public:
+    StringNode(std::string v) : ConstantNode(std::make_shared<StringObject>(v)) {}
 };
 class VariableNode : public ASTNode {
 public:
@@ -524,58 +3057,167 @@ public:
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         return interpreter.lookup(name);
     }
+    std::string describe() const override { return "Variable " + name; }
 };
+enum BinaryOp { OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_LT, OP_GT, OP_EQ, OP_NE, OP_AND, OP_OR, OP_XOR, OP_SHL, OP_SHR };
+BinaryOp binaryOpFor(const std::string& op) {
+    static const std::map<std::string, BinaryOp> ops = {
+        {"+", OP_ADD}, {"-", OP_SUB}, {"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD}, {"<", OP_LT}, {">", OP_GT},
+        {"==", OP_EQ}, {"!=", OP_NE}, {"&", OP_AND}, {"|", OP_OR}, {"^", OP_XOR}, {"<<", OP_SHL}, {">>", OP_SHR},
+    };
+    auto it = ops.find(op);
+    if (it == ops.end()) throw_parser_error("Unknown operator '" + op + "'");
+    return it->second;
+}
+// Integer arithmetic uses the hardware instructions and only falls back to doubles when the
+// result is not an integer (inexact division) or would overflow int64.
+std::shared_ptr<ULangObject> applyIntegerOp(BinaryOp op, int64_t a, int64_t b) {
+    int64_t r;
+    switch (op) {
+        case OP_ADD: if (__builtin_add_overflow(a, b, &r)) return std::make_shared<NumberObject>((double)a + (double)b); return NumberObject::integer(r);
+        case OP_SUB: if (__builtin_sub_overflow(a, b, &r)) return std::make_shared<NumberObject>((double)a - (double)b); return NumberObject::integer(r);
+        case OP_MUL: if (__builtin_mul_overflow(a, b, &r)) return std::make_shared<NumberObject>((double)a * (double)b); return NumberObject::integer(r);
+        case OP_DIV:
+            if (b == 0 || (a == INT64_MIN && b == -1) || a % b != 0) return std::make_shared<NumberObject>((double)a / (double)b);
+            return NumberObject::integer(a / b);
+        case OP_MOD:
+            if (b == 0) return std::make_shared<NumberObject>(std::nan(""));
+            if (b == -1) return NumberObject::integer(0);
+            return NumberObject::integer(a % b);
+        case OP_LT: return std::make_shared<BooleanObject>(a < b);
+        case OP_GT: return std::make_shared<BooleanObject>(a > b);
+        case OP_EQ: return std::make_shared<BooleanObject>(a == b);
+        case OP_NE: return std::make_shared<BooleanObject>(a != b);
+        case OP_AND: return NumberObject::integer(a & b);
+        case OP_OR: return NumberObject::integer(a | b);
+        case OP_XOR: return NumberObject::integer(a ^ b);
+        case OP_SHL:
+        case OP_SHR:
+            if (b < 0 || b > 63) throw_runtime_error("Shift count must be between 0 and 63");
+            return NumberObject::integer(op == OP_SHL ? (int64_t)((uint64_t)a << b) : a >> b);
+    }
+    return VOID_INSTANCE;
+}
+std::shared_ptr<ULangObject> applyBinaryOp(BinaryOp op, const std::shared_ptr<ULangObject>& l, const std::shared_ptr<ULangObject>& r) {
+    if (l->type == ULangObject::NUMBER && r->type == ULangObject::NUMBER) {
+        auto a = static_cast<NumberObject*>(l.get());
+        auto b = static_cast<NumberObject*>(r.get());
+        if (a->isInt && b->isInt) return applyIntegerOp(op, a->ivalue, b->ivalue);
+        double v1 = a->value;
+        double v2 = b->value;
+        switch (op) {
+            case OP_ADD: return std::make_shared<NumberObject>(v1 + v2);
+            case OP_SUB: return std::make_shared<NumberObject>(v1 - v2);
+            case OP_MUL: return std::make_shared<NumberObject>(v1 * v2);
+            case OP_DIV: return std::make_shared<NumberObject>(v1 / v2);
+            case OP_MOD: return std::make_shared<NumberObject>(std::fmod(v1, v2));
+            case OP_LT: return std::make_shared<BooleanObject>(v1 < v2);
+            case OP_GT: return std::make_shared<BooleanObject>(v1 > v2);
+            case OP_EQ: return std::make_shared<BooleanObject>(v1 == v2);
+            case OP_NE: return std::make_shared<BooleanObject>(v1 != v2);
+            default: {
+                int64_t i1, i2;
+                if (!a->asInteger(i1) || !b->asInteger(i2)) throw_runtime_error("Bitwise operators require integers");
+                return applyIntegerOp(op, i1, i2);
+            }
+        }
+    }
+    if (op == OP_EQ || op == OP_NE) {
+        bool equal;
+        if (l->type == ULangObject::STRING && r->type == ULangObject::STRING) {
+            equal = static_cast<StringObject*>(l.get())->view() == static_cast<StringObject*>(r.get())->view();
+        } else if (l->type == ULangObject::BYTES || r->type == ULangObject::BYTES) {
+            // Bytes only equal bytes with the same content; their text form is just a size label.
+            equal = l->type == r->type && static_cast<BytesObject*>(l.get())->data == static_cast<BytesObject*>(r.get())->data;
+        } else {
+            equal = l->toString() == r->toString();
+        }
+        return std::make_shared<BooleanObject>(op == OP_EQ ? equal : !equal);
+    }
+    if (op == OP_ADD) {
+        std::string joined;
+        if (l->type == ULangObject::STRING) joined.reserve(static_cast<StringObject*>(l.get())->size() + 24);
+        l->appendTo(joined);
+        r->appendTo(joined);
+        return std::make_shared<StringObject>(std::move(joined));
+    }
+    throw_runtime_error("Invalid binary operation");
+    return VOID_INSTANCE;
+}
 class BinaryOpNode : public ASTNode {
+public:
     std::string op;
+    BinaryOp code;
     std::shared_ptr<ASTNode> left, right;
-public:
-    BinaryOpNode(std::string o, std::shared_ptr<ASTNode> l, std::shared_ptr<ASTNode> r) : op(o), left(l), right(r) {}
+    BinaryOpNode(std::string o, std::shared_ptr<ASTNode> l, std::shared_ptr<ASTNode> r) : op(o), code(binaryOpFor(o)), left(l), right(r) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         auto l = left->evaluate(interpreter);
         auto r = right->evaluate(interpreter);
-        if (op == "==") return std::make_shared<BooleanObject>(l->toString() == r->toString());
-        if (op == "!=") return std::make_shared<BooleanObject>(l->toString() != r->toString());
-        if (l->type == ULangObject::NUMBER && r->type == ULangObject::NUMBER) {
-            double v1 = l->toDouble();
-            double v2 = r->toDouble();
-            if (op == "+") return std::make_shared<NumberObject>(v1 + v2);
-            if (op == "-") return std::make_shared<NumberObject>(v1 - v2);
-            if (op == "*") return std::make_shared<NumberObject>(v1 * v2);
-            if (op == "/") return std::make_shared<NumberObject>(v1 / v2);
-            if (op == "%") return std::make_shared<NumberObject>(std::fmod(v1, v2));
-            if (op == "<") return std::make_shared<BooleanObject>(v1 < v2);
-            if (op == ">") return std::make_shared<BooleanObject>(v1 > v2);
-        }
-        if (op == "+") return std::make_shared<StringObject>(l->toString() + r->toString());
-        throw_runtime_error("Invalid binary operation");
-        return VOID_INSTANCE;
+        return applyBinaryOp(code, l, r);
     }
+    std::string describe() const override { return "BinaryOp " + op; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(left); visit(right); }
+};
+// Produced by the strength-reduction pass: x * 2 becomes x + x and pow(x, 2) becomes x * x,
+// evaluating the operand once and keeping the error behaviour of the original expression.
+class StrengthReducedNode : public ASTNode {
+public:
+    enum Kind { TWICE, SQUARE };
+    Kind kind;
+    std::shared_ptr<ASTNode> operand;
+    StrengthReducedNode(Kind k, std::shared_ptr<ASTNode> o) : kind(k), operand(o) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        auto v = operand->evaluate(interpreter);
+        if (kind == SQUARE) {
+            if (v->type == ULangObject::NUMBER) return applyBinaryOp(OP_MUL, v, v);
+            double d = v->toDouble();
+            return std::make_shared<NumberObject>(d * d);
+        }
+        if (v->type != ULangObject::NUMBER) throw_runtime_error("Invalid binary operation");
+        return applyBinaryOp(OP_ADD, v, v);
+    }
+    std::string describe() const override { return kind == SQUARE ? "Square" : "Twice"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(operand); }
+};
+// A loop-invariant expression hoisted by the optimiser. The owning loop clears the cache on entry,
+// so the expression is still evaluated lazily at its original position, but only once per loop run.
+class InvariantNode : public ASTNode {
+public:
+    std::shared_ptr<ASTNode> expr;
+    std::shared_ptr<ULangObject> cached;
+    InvariantNode(std::shared_ptr<ASTNode> e) : expr(e) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        if (!cached) cached = expr->evaluate(interpreter);
+        return cached;
+    }
+    std::string describe() const override { return "Invariant"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(expr); }
 };
 class AssignmentNode : public ASTNode {
+public:
     std::string name;
     std::shared_ptr<ASTNode> value;
-public:
     AssignmentNode(std::string n, std::shared_ptr<ASTNode> v) : name(n), value(v) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         auto res = value->evaluate(interpreter);
-        try {
-            interpreter.assign(name, res);
-        } catch (...) {
-            interpreter.define(name, res);
-        }
+        if (!interpreter.assign(name, res)) interpreter.define(name, res);
         return res;
     }
+    std::string describe() const override { return "Assign " + name; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(value); }
 };
 class VarDeclNode : public ASTNode {
+public:
     std::string name;
     std::shared_ptr<ASTNode> value;
-public:
     VarDeclNode(std::string n, std::shared_ptr<ASTNode> v) : name(n), value(v) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         auto res = value->evaluate(interpreter);
         interpreter.define(name, res);
         return res;
     }
+    std::string describe() const override { return "VarDecl " + name; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(value); }
 };
 class BlockNode : public ASTNode {
 public:
@@ -584,141 +3226,247 @@ public:
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         return interpreter.executeBlock(statements);
     }
+    std::string describe() const override { return "Block"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { for (auto& s : statements) visit(s); }
 };
 class IfNode : public ASTNode {
-    std::shared_ptr<ASTNode> condition, thenBlock, elseBlock;
 public:
+    std::shared_ptr<ASTNode> condition, thenBlock, elseBlock;
     IfNode(std::shared_ptr<ASTNode> c, std::shared_ptr<ASTNode> t, std::shared_ptr<ASTNode> e) : condition(c), thenBlock(t), elseBlock(e) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         if (condition->evaluate(interpreter)->isTruthy()) return thenBlock->evaluate(interpreter);
         else if (elseBlock) return elseBlock->evaluate(interpreter);
         return VOID_INSTANCE;
     }
+    std::string describe() const override { return "If"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override {
+        visit(condition); visit(thenBlock);
+        if (elseBlock) visit(elseBlock);
+    }
 };
 class WhileNode : public ASTNode {
-    std::shared_ptr<ASTNode> condition, body;
 public:
+    std::shared_ptr<ASTNode> condition, body;
+    std::vector<std::shared_ptr<InvariantNode>> invariants;
     WhileNode(std::shared_ptr<ASTNode> c, std::shared_ptr<ASTNode> b) : condition(c), body(b) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        for (auto& inv : invariants) inv->cached = nullptr;
         while (condition->evaluate(interpreter)->isTruthy()) {
             body->evaluate(interpreter);
+            if (interpreter.returning) break;
+            interpreter.step();
         }
         return VOID_INSTANCE;
     }
+    std::string describe() const override { return "While"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(condition); visit(body); }
 };
 class ForNode : public ASTNode {
+public:
     std::string varName;
     std::shared_ptr<ASTNode> iterator, body;
-public:
+    std::vector<std::shared_ptr<InvariantNode>> invariants;
     ForNode(std::string v, std::shared_ptr<ASTNode> i, std::shared_ptr<ASTNode> b) : varName(v), iterator(i), body(b) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         auto listObj = iterator->evaluate(interpreter);
         if (listObj->type != ULangObject::LIST) throw_runtime_error("For loop expects list");
         auto list = std::static_pointer_cast<ListObject>(listObj);
+        for (auto& inv : invariants) inv->cached = nullptr;
         interpreter.pushEnv();
         interpreter.define(varName, VOID_INSTANCE);
         for (auto& elem : list->elements) {
             interpreter.assign(varName, elem);
             body->evaluate(interpreter);
+            if (interpreter.returning) break;
+            interpreter.step();
         }
         interpreter.popEnv();
         return VOID_INSTANCE;
     }
+    std::string describe() const override { return "For " + varName; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(iterator); visit(body); }
+};
+class PropertyGetNode : public ASTNode {
+public:
+    std::shared_ptr<ASTNode> obj;
+    std::string prop;
+    PropertyGetNode(std::shared_ptr<ASTNode> o, std::string p) : obj(o), prop(p) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        return getFrom(obj->evaluate(interpreter), prop);
+    }
+    static std::shared_ptr<ULangObject> getFrom(const std::shared_ptr<ULangObject>& o, const std::string& prop) {
+        if(o->type == ULangObject::INSTANCE) return std::static_pointer_cast<InstanceObject>(o)->getProperty(prop);
+        if(o->type == ULangObject::MODULE) {
+            auto module = std::static_pointer_cast<ModuleObject>(o);
+            auto it = module->globals.find(prop);
+            if (it != module->globals.end()) return it->second;
+            throw_runtime_error("Module '" + module->name + "' has no member '" + prop + "'.");
+        }
+        if(o->type == ULangObject::LIST) {
+            if (auto m = o->getMethod(prop)) return m;
+            throw_runtime_error("Undefined list method '" + prop + "'.");
+        }
+        if (o->type == ULangObject::ERROR) return static_cast<ErrorObject*>(o.get())->field(prop);
+        if (auto m = o->getMethod(prop)) return m;
+        throw_runtime_error("Property access on invalid object");
+        return VOID_INSTANCE;
+    }
+    std::string describe() const override { return "GetProperty " + prop; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(obj); }
 };
 class CallNode : public ASTNode {
+public:
     std::shared_ptr<ASTNode> callee;
     std::vector<std::shared_ptr<ASTNode>> args;
-public:
     CallNode(std::shared_ptr<ASTNode> c, std::vector<std::shared_ptr<ASTNode>> a) : callee(c), args(a) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
-        auto func = callee->evaluate(interpreter);
-        std::vector<std::shared_ptr<ULangObject>> evalArgs;
-        for(auto& a : args) evalArgs.push_back(a->evaluate(interpreter));
-        if (func->type == ULangObject::FUNCTION) return std::static_pointer_cast<FunctionObject>(func)->call(interpreter, evalArgs);
-        if (func->type == ULangObject::BUILTIN) return std::static_pointer_cast<BuiltinFunction>(func)->call(interpreter, evalArgs);
-        if (func->type == ULangObject::CLASS) {
-            auto klass = std::static_pointer_cast<ClassObject>(func);
-            auto instance = std::make_shared<InstanceObject>(klass);
-            if (klass->methods.count("__init__")) {
-                auto init = klass->methods.at("__init__")->bind(instance);
-                init->call(interpreter, evalArgs);
+        return evaluateCall(interpreter, false);
+    }
+    // With tail set, a call to a plain ULang function is scheduled on the interpreter and nullptr is
+    // returned; builtins, constructors, memoised and async functions are still called directly.
+    std::shared_ptr<ULangObject> evaluateCall(Interpreter& interpreter, bool tail) {
+        ValueStackMark mark(interpreter.valueStack);
+        // obj.method(...) is dispatched directly, without materialising a bound method object.
+        if (auto get = dynamic_cast<PropertyGetNode*>(callee.get())) {
+            auto obj = get->obj->evaluate(interpreter);
+            if (obj->type == ULangObject::INSTANCE) {
+                auto instance = std::static_pointer_cast<InstanceObject>(obj);
+                auto method = instance->klass->methods.find(get->prop);
+                if (!instance->fields.count(get->prop) && method != instance->klass->methods.end()) {
+                    ArgList evalArgs = pushArgs(interpreter, mark);
+                    if (tail && !method->second->memo && !method->second->isAsync) return interpreter.scheduleTailCall(method->second, instance, evalArgs);
+                    return method->second->invoke(interpreter, evalArgs, instance);
+                }
+            } else if (obj->type == ULangObject::LIST) {
+                return std::static_pointer_cast<ListObject>(obj)->callMethod(get->prop, pushArgs(interpreter, mark));
             }
-            return instance;
+            return callValue(interpreter, PropertyGetNode::getFrom(obj, get->prop), mark, tail);
         }
+        return callValue(interpreter, callee->evaluate(interpreter), mark, tail);
+    }
+    ArgList pushArgs(Interpreter& interpreter, const ValueStackMark& mark) {
+        for (auto& a : args) interpreter.valueStack.push_back(a->evaluate(interpreter));
+        return ArgList(interpreter.valueStack.data() + mark.base, args.size());
+    }
+    std::shared_ptr<ULangObject> callValue(Interpreter& interpreter, const std::shared_ptr<ULangObject>& func, const ValueStackMark& mark, bool tail) {
+        ArgList evalArgs = pushArgs(interpreter, mark);
+        if (func->type == ULangObject::FUNCTION) {
+            auto fn = std::static_pointer_cast<FunctionObject>(func);
+            if (tail && !fn->memo && !fn->isAsync) return interpreter.scheduleTailCall(fn, fn->receiver, evalArgs);
+            return fn->call(interpreter, evalArgs);
+        }
+        if (func->type == ULangObject::BUILTIN) return std::static_pointer_cast<BuiltinFunction>(func)->call(interpreter, evalArgs);
+        if (func->type == ULangObject::CLASS) return construct(interpreter, std::static_pointer_cast<ClassObject>(func), evalArgs);
         throw_runtime_error("Not callable");
         return VOID_INSTANCE;
     }
+    static std::shared_ptr<ULangObject> construct(Interpreter& interpreter, const std::shared_ptr<ClassObject>& klass, const ArgList& args) {
+        auto instance = std::make_shared<InstanceObject>(klass);
+        auto init = klass->methods.find("__init__");
+        if (init != klass->methods.end()) init->second->invoke(interpreter, args, instance);
+        return instance;
+    }
+    std::string describe() const override { return "Call"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override {
+        visit(callee);
+        for (auto& a : args) visit(a);
+    }
 };
 class InstanceCreation : public ASTNode {
+public:
     std::string className;
     std::vector<std::shared_ptr<ASTNode>> args;
-public:
     InstanceCreation(std::string c, std::vector<std::shared_ptr<ASTNode>> a) : className(c), args(a) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         auto classObj = interpreter.lookup(className);
         if (classObj->type != ULangObject::CLASS) throw_runtime_error("Not a class");
-        auto klass = std::static_pointer_cast<ClassObject>(classObj);
-        auto instance = std::make_shared<InstanceObject>(klass);
-        std::vector<std::shared_ptr<ULangObject>> evalArgs;
-        for(auto& a : args) evalArgs.push_back(a->evaluate(interpreter));
-        if (klass->methods.count("__init__")) {
-            auto init = klass->methods.at("__init__")->bind(instance);
-            init->call(interpreter, evalArgs);
-        }
-        return instance;
+        ValueStackMark mark(interpreter.valueStack);
+        for (auto& a : args) interpreter.valueStack.push_back(a->evaluate(interpreter));
+        return CallNode::construct(interpreter, std::static_pointer_cast<ClassObject>(classObj),
+                                   ArgList(interpreter.valueStack.data() + mark.base, args.size()));
     }
+    std::string describe() const override { return "New " + className; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { for (auto& a : args) visit(a); }
 };
 class ReturnNode : public ASTNode {
-    std::shared_ptr<ASTNode> value;
 public:
+    std::shared_ptr<ASTNode> value;
+    // Set by the parser when the return is not inside a try block, so its call may reuse the frame.
+    bool tailPosition = false;
     ReturnNode(std::shared_ptr<ASTNode> v) : value(v) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        if (tailPosition && interpreter.callDepth > 0) {
+            if (auto call = dynamic_cast<CallNode*>(value.get())) {
+                auto res = call->evaluateCall(interpreter, true);
+                interpreter.returnValue = res;
+                interpreter.returning = true;
+                return res ? res : VOID_INSTANCE;
+            }
+        }
         auto res = value ? value->evaluate(interpreter) : VOID_INSTANCE;
-        throw res;
+        interpreter.returnValue = res;
+        interpreter.returning = true;
+        return res;
     }
+    std::string describe() const override { return tailPosition ? "Return (tail)" : "Return"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { if (value) visit(value); }
 };
 class FunctionDeclNode : public ASTNode {
+public:
     std::string name;
     std::vector<std::string> params;
     std::shared_ptr<ASTNode> body;
-public:
+    // Set by a leading @memo annotation; zero means the function is not memoised.
+    size_t memoCapacity = 0;
+    bool memoCheckPurity = false;
+    bool isAsync = false;
+    // Set instead of body when the body is parsed on first call.
+    std::shared_ptr<LazyBody> lazy;
     FunctionDeclNode(std::string n, std::vector<std::string> p, std::shared_ptr<ASTNode> b) : name(n), params(p), body(b) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         std::vector<std::shared_ptr<ASTNode>> stmts;
         if (auto b = std::dynamic_pointer_cast<BlockNode>(body)) stmts = b->statements;
-        else stmts.push_back(body);
+        else if (body) stmts.push_back(body);
         auto func = std::make_shared<FunctionObject>(params, stmts);
+        func->name = name;
+        func->isAsync = isAsync;
+        func->module = interpreter.module;
+        func->lazy = lazy && !lazy->parsed ? lazy : nullptr;
+        if (lazy && lazy->parsed) func->body = lazy->statements;
+        if (memoCapacity) interpreter.memoize(func, memoCapacity, memoCheckPurity);
         interpreter.define(name, func);
         return func;
     }
+    std::string describe() const override {
+        return std::string(isAsync ? "Async " : "") + "Function " + name + (memoCapacity ? " @memo" : "") + (lazy ? " (lazy)" : "");
+    }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { if (body) visit(body); }
 };
 class ClassNode : public ASTNode {
+public:
     std::string name;
     std::map<std::string, std::shared_ptr<FunctionObject>> methods;
-public:
     ClassNode(std::string n, std::map<std::string, std::shared_ptr<FunctionObject>> m) : name(n), methods(m) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
-        interpreter.define(name, std::make_shared<ClassObject>(name, methods));
+        // The parsed methods may be shared by several interpreters (see importModule); bind copies.
+        std::map<std::string, std::shared_ptr<FunctionObject>> bound;
+        for (auto& m : methods) {
+            auto method = std::make_shared<FunctionObject>(*m.second);
+            method->module = interpreter.module;
+            bound[m.first] = method;
+        }
+        interpreter.define(name, std::make_shared<ClassObject>(name, bound));
         return VOID_INSTANCE;
     }
-};
-class PropertyGetNode : public ASTNode {
-public:
-    std::shared_ptr<ASTNode> obj;
-    std::string prop;
-    PropertyGetNode(std::shared_ptr<ASTNode> o, std::string p) : obj(o), prop(p) {}
-    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
-        auto o = obj->evaluate(interpreter);
-        if(o->type == ULangObject::INSTANCE) return std::static_pointer_cast<InstanceObject>(o)->getProperty(prop);
-        if(o->type == ULangObject::LIST) return std::static_pointer_cast<ListObject>(o)->getMethod(prop);
-        throw_runtime_error("Property access on invalid object");
-        return VOID_INSTANCE;
+    std::string describe() const override { return "Class " + name; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override {
+        for (auto& m : methods) for (auto& s : m.second->body) visit(s);
     }
 };
 class PropertySetNode : public ASTNode {
+public:
     std::shared_ptr<ASTNode> obj, val;
     std::string prop;
-public:
     PropertySetNode(std::shared_ptr<ASTNode> o, std::string p, std::shared_ptr<ASTNode> v) : obj(o), prop(p), val(v) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         auto o = obj->evaluate(interpreter);
@@ -730,40 +3478,136 @@ public:
         throw_runtime_error("Property set on invalid object");
         return VOID_INSTANCE;
     }
+    std::string describe() const override { return "SetProperty " + prop; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(obj); visit(val); }
 };
 class ListNode : public ASTNode {
-    std::vector<std::shared_ptr<ASTNode>> elements;
 public:
+    std::vector<std::shared_ptr<ASTNode>> elements;
     ListNode(std::vector<std::shared_ptr<ASTNode>> e) : elements(e) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
         std::vector<std::shared_ptr<ULangObject>> values;
         for(auto& e : elements) values.push_back(e->evaluate(interpreter));
         return std::make_shared<ListObject>(values);
     }
+    std::string describe() const override { return "List"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { for (auto& e : elements) visit(e); }
+};
+class IndexNode : public ASTNode {
+public:
+    std::shared_ptr<ASTNode> obj, index;
+    IndexNode(std::shared_ptr<ASTNode> o, std::shared_ptr<ASTNode> i) : obj(o), index(i) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        auto o = obj->evaluate(interpreter);
+        auto i = index->evaluate(interpreter);
+        if (o->type == ULangObject::BYTES) {
+            auto& data = static_cast<BytesObject*>(o.get())->data;
+            return NumberObject::integer((unsigned char)data[checkedIndex(data.size(), i, "Bytes")]);
+        }
+        if (o->type == ULangObject::STRING) {
+            auto str = std::static_pointer_cast<StringObject>(o);
+            return StringObject::slice(str, checkedIndex(str->size(), i, "String"), 1);
+        }
+        if (o->type != ULangObject::LIST) throw_runtime_error("Indexing requires a list");
+        auto& list = *static_cast<ListObject*>(o.get());
+        return list.elements[listIndex(list, i)];
+    }
+    std::string describe() const override { return "Index"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(obj); visit(index); }
+};
+class IndexSetNode : public ASTNode {
+public:
+    std::shared_ptr<ASTNode> obj, index, val;
+    IndexSetNode(std::shared_ptr<ASTNode> o, std::shared_ptr<ASTNode> i, std::shared_ptr<ASTNode> v) : obj(o), index(i), val(v) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        auto o = obj->evaluate(interpreter);
+        auto i = index->evaluate(interpreter);
+        auto v = val->evaluate(interpreter);
+        if (o->type == ULangObject::BYTES) {
+            auto& data = static_cast<BytesObject*>(o.get())->data;
+            int64_t byte;
+            if (v->type != ULangObject::NUMBER || !static_cast<NumberObject*>(v.get())->asInteger(byte) || byte < 0 || byte > 255)
+                throw_runtime_error("A byte must be an integer from 0 to 255");
+            data[checkedIndex(data.size(), i, "Bytes")] = (char)byte;
+            return v;
+        }
+        if (o->type == ULangObject::STRING) throw_runtime_error("Strings are immutable; use bytes() for a mutable buffer");
+        if (o->type != ULangObject::LIST) throw_runtime_error("Indexing requires a list");
+        auto& list = *static_cast<ListObject*>(o.get());
+        list.elements[listIndex(list, i)] = v;
+        return v;
+    }
+    std::string describe() const override { return "SetIndex"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(obj); visit(index); visit(val); }
 };
 class TryCatchNode : public ASTNode {
+public:
     std::shared_ptr<ASTNode> tryBlock, catchBlock;
     std::string catchVar;
-public:
     TryCatchNode(std::shared_ptr<ASTNode> t, std::string v, std::shared_ptr<ASTNode> c) : tryBlock(t), catchVar(v), catchBlock(c) {}
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        size_t depth = interpreter.depth;
+        std::shared_ptr<ULangObject> error;
         try {
             return tryBlock->evaluate(interpreter);
+        } catch (const ULangError& e) {
+            error = std::make_shared<ErrorObject>(e.type, e.what(), e.line, e.column);
         } catch (const std::exception& e) {
-            interpreter.pushEnv();
-            interpreter.define(catchVar, std::make_shared<StringObject>(e.what()));
-            auto res = catchBlock->evaluate(interpreter);
-            interpreter.popEnv();
-            return res;
-        } catch (std::shared_ptr<ULangObject> e) {
-             interpreter.pushEnv();
-             interpreter.define(catchVar, e);
-             auto res = catchBlock->evaluate(interpreter);
-             interpreter.popEnv();
-             return res;
+            error = std::make_shared<ErrorObject>("Runtime", e.what(), current_line, current_column);
         }
+        // Blocks and loops the error unwound through did not pop their scopes.
+        while (interpreter.depth > depth) interpreter.popEnv();
+        interpreter.pushEnv();
+        interpreter.define(catchVar, error);
+        auto res = catchBlock->evaluate(interpreter);
+        interpreter.popEnv();
+        return res;
+    }
+    std::string describe() const override { return "TryCatch " + catchVar; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(tryBlock); visit(catchBlock); }
+};
+class ImportNode : public ASTNode {
+public:
+    std::string spec, alias;
+    ImportNode(std::string s, std::string a) : spec(s), alias(a) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        auto module = interpreter.importModule(spec);
+        interpreter.define(alias, module);
+        return module;
+    }
+    std::string describe() const override { return "Import \"" + spec + "\" as " + alias; }
+};
+class FromImportNode : public ASTNode {
+public:
+    std::string spec;
+    // (name in the module, name bound here)
+    std::vector<std::pair<std::string, std::string>> names;
+    FromImportNode(std::string s, std::vector<std::pair<std::string, std::string>> n) : spec(s), names(n) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        auto module = interpreter.importModule(spec);
+        for (auto& n : names) interpreter.define(n.second, PropertyGetNode::getFrom(module, n.first));
+        return module;
+    }
+    std::string describe() const override {
+        std::string d = "FromImport \"" + spec + "\"";
+        for (auto& n : names) d += " " + n.first + (n.first == n.second ? "" : " as " + n.second);
+        return d;
     }
 };
+// Waits for a task and yields its result, rethrowing its error. Inside a task this suspends the task;
+// in the main program it runs the event loop until the task is done. Other values pass through.
+class AwaitNode : public ASTNode {
+public:
+    std::shared_ptr<ASTNode> value;
+    AwaitNode(std::shared_ptr<ASTNode> v) : value(v) {}
+    std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
+        auto v = value->evaluate(interpreter);
+        if (v->type != ULangObject::TASK) return v;
+        return interpreter.loop.await(std::static_pointer_cast<TaskObject>(v));
+    }
+    std::string describe() const override { return "Await"; }
+    void children(const std::function<void(std::shared_ptr<ASTNode>&)>& visit) override { visit(value); }
+};
 class ThisNode : public ASTNode {
 public:
     std::shared_ptr<ULangObject> evaluate(Interpreter& interpreter) override {
@@ -771,33 +3615,112 @@ public:
         throw_runtime_error("this used outside of instance");
         return VOID_INSTANCE;
     }
+    std::string describe() const override { return "This"; }
 };
+// Pulls tokens from the lexer with one token of lookahead, fetched only when needed, so a
+// top-level statement ending in ';' or '}' can run before the next one has even been written.
 class Parser {
-    std::vector<Token> tokens;
-    int pos = 0;
+    Lexer& lexer;
+    Token current;
+    bool haveCurrent = false;
+    Token previous;
+    // try blocks enclosing the current point of the current function; returns inside them are not tail calls.
+    int tryDepth = 0;
+    // Set for imported modules: function bodies are skipped and parsed on their first call, so
+    // library code a program never calls costs a brace scan instead of a parse.
+    bool lazyBodies;
 public:
-    Parser(std::vector<Token> t) : tokens(t) {}
-    Token peek() { return tokens[pos]; }
+    Parser(Lexer& l, bool lazy = false) : lexer(l), current(TOK_EOF, ""), previous(TOK_EOF, ""), lazyBodies(lazy) {}
+    const Token& peek() {
+        if (!haveCurrent) {
+            current = lexer.next();
+            haveCurrent = true;
+        }
+        return current;
+    }
     bool isAtEnd() { return peek().type == TOK_EOF; }
-    Token advance() { if (!isAtEnd()) pos++; return tokens[pos-1]; }
+    Token advance() {
+        if (!isAtEnd()) {
+            previous = std::move(current);
+            haveCurrent = false;
+        }
+        return previous;
+    }
     bool check(TokenKind t) { return !isAtEnd() && peek().type == t; }
-    Token consume(TokenKind t, std::string msg) { if (check(t)) return advance(); throw_parser_error(msg); return tokens[0]; }
+    Token consume(TokenKind t, std::string msg) { if (check(t)) return advance(); throw_parser_error(msg); return previous; }
     std::vector<std::shared_ptr<ASTNode>> parse() {
         std::vector<std::shared_ptr<ASTNode>> stmts;
         while (!isAtEnd()) stmts.push_back(declaration());
         return stmts;
     }
     std::shared_ptr<ASTNode> declaration() {
+        int line = peek().line, column = peek().column;
+        auto node = declarationBody();
+        if (node && node->line == 0) {
+            node->line = line;
+            node->column = column;
+        }
+        return node;
+    }
+    std::shared_ptr<ASTNode> declarationBody() {
+        if (check(TOK_AT)) return annotatedDecl();
         if (check(TOK_FUNCTION)) return functionDecl();
+        if (check(TOK_ASYNC)) {
+            advance();
+            if (!check(TOK_FUNCTION)) throw_parser_error("Expect function after async");
+            auto decl = std::static_pointer_cast<FunctionDeclNode>(functionDecl());
+            decl->isAsync = true;
+            return decl;
+        }
         if (check(TOK_CLASS)) return classDecl();
+        if (check(TOK_IMPORT)) return importStmt();
+        if (check(TOK_FROM)) return fromImportStmt();
         return statement();
     }
+    // A module is named by a path string or a bare name; ".ul" is implied.
+    std::string moduleSpec() {
+        if (check(TOK_STRING_LIT)) return advance().text;
+        return consume(TOK_ID, "Expect module name or path").text;
+    }
+    bool checkAs() { return check(TOK_ID) && peek().text == "as"; }
+    // import "path" [as name]: binds the module under its file name without ".ul", or under name.
+    std::shared_ptr<ASTNode> importStmt() {
+        consume(TOK_IMPORT, "Expect import");
+        std::string spec = moduleSpec();
+        std::string alias = spec.substr(spec.find_last_of('/') + 1);
+        if (alias.size() > 3 && alias.compare(alias.size() - 3, 3, ".ul") == 0) alias.resize(alias.size() - 3);
+        if (checkAs()) {
+            advance();
+            alias = consume(TOK_ID, "Expect name after as").text;
+        }
+        if (check(TOK_SEMICOLON)) advance();
+        return std::make_shared<ImportNode>(spec, alias);
+    }
+    // from "path" import a, b as c
+    std::shared_ptr<ASTNode> fromImportStmt() {
+        consume(TOK_FROM, "Expect from");
+        std::string spec = moduleSpec();
+        consume(TOK_IMPORT, "Expect import");
+        std::vector<std::pair<std::string, std::string>> names;
+        do {
+            std::string name = consume(TOK_ID, "Expect name to import").text;
+            std::string alias = name;
+            if (checkAs()) {
+                advance();
+                alias = consume(TOK_ID, "Expect name after as").text;
+            }
+            names.emplace_back(name, alias);
+        } while (check(TOK_COMMA) && advance().type == TOK_COMMA);
+        if (check(TOK_SEMICOLON)) advance();
+        return std::make_shared<FromImportNode>(spec, names);
+    }
     std::shared_ptr<ASTNode> classDecl() {
         consume(TOK_CLASS, "Expect class");
         std::string name = consume(TOK_ID, "Expect class name").text;
         consume(TOK_LBRACE, "Expect {");
         std::map<std::string, std::shared_ptr<FunctionObject>> methods;
         while(!check(TOK_RBRACE) && !isAtEnd()) {
+            bool isAsync = check(TOK_ASYNC) && advance().type == TOK_ASYNC;
             std::string mName = consume(TOK_ID, "Expect method name").text;
             consume(TOK_LPAREN, "Expect (");
             std::vector<std::string> params;
@@ -806,7 +3729,10 @@ public:
             }
             consume(TOK_RPAREN, "Expect )");
             consume(TOK_LBRACE, "Expect {");
+            int outerTryDepth = tryDepth;
+            tryDepth = 0;
             auto body = block();
+            tryDepth = outerTryDepth;
             std::vector<std::shared_ptr<ASTNode>> bodyStmts;
             if (auto b = std::dynamic_pointer_cast<BlockNode>(body)) {
                 bodyStmts = b->statements;
@@ -814,10 +3740,37 @@ public:
                 bodyStmts.push_back(body);
             }
             methods[mName] = std::make_shared<FunctionObject>(params, bodyStmts);
+            methods[mName]->name = name + "." + mName;
+            methods[mName]->isAsync = isAsync;
         }
         consume(TOK_RBRACE, "Expect }");
         return std::make_shared<ClassNode>(name, methods);
     }
+    // @memo, @memo(size), @memo(pure) or @memo(size, pure) in front of a function declaration.
+    std::shared_ptr<ASTNode> annotatedDecl() {
+        consume(TOK_AT, "Expect @");
+        std::string annotation = consume(TOK_ID, "Expect annotation name").text;
+        if (annotation != "memo") throw_parser_error("Unknown annotation '@" + annotation + "'");
+        size_t capacity = 4096;
+        bool pure = false;
+        if (check(TOK_LPAREN)) {
+            advance();
+            do {
+                if (check(TOK_NUMBER)) {
+                    capacity = memoCapacityOf(std::stod(advance().text));
+                    if (!capacity) throw_parser_error("@memo cache size must be a whole number from 1 to 4294967296");
+                }
+                else if (check(TOK_ID) && peek().text == "pure") { advance(); pure = true; }
+                else throw_parser_error("Expect cache size or 'pure' in @memo");
+            } while (check(TOK_COMMA) && advance().type == TOK_COMMA);
+            consume(TOK_RPAREN, "Expect )");
+        }
+        if (!check(TOK_FUNCTION)) throw_parser_error("@memo must precede a function declaration");
+        auto decl = std::static_pointer_cast<FunctionDeclNode>(functionDecl());
+        decl->memoCapacity = capacity;
+        decl->memoCheckPurity = pure;
+        return decl;
+    }
     std::shared_ptr<ASTNode> functionDecl() {
         consume(TOK_FUNCTION, "Expect function");
         std::string name = consume(TOK_ID, "Expect name").text;
@@ -828,7 +3781,17 @@ public:
         }
         consume(TOK_RPAREN, "Expect )");
         consume(TOK_LBRACE, "Expect {");
-        return std::make_shared<FunctionDeclNode>(name, params, block());
+        if (lazyBodies) {
+            int line = current_line, column = current_column;
+            auto decl = std::make_shared<FunctionDeclNode>(name, params, nullptr);
+            decl->lazy = std::make_shared<LazyBody>(lexer.skipBlock(), line, column);
+            return decl;
+        }
+        int outerTryDepth = tryDepth;
+        tryDepth = 0;
+        auto body = block();
+        tryDepth = outerTryDepth;
+        return std::make_shared<FunctionDeclNode>(name, params, body);
     }
     std::shared_ptr<ASTNode> statement() {
         if (check(TOK_IF)) return ifStmt();
@@ -854,6 +3817,9 @@ public:
             advance();
             if (check(TOK_IF)) elseB = ifStmt();
             else { consume(TOK_LBRACE, "{"); elseB = block(); }
+        } else if (check(TOK_SEMICOLON)) {
+            // `if (...) { ... };` ends the statement without waiting for a possible else.
+            advance();
         }
         return std::make_shared<IfNode>(cond, thenB, elseB);
     }
@@ -878,12 +3844,16 @@ public:
         std::shared_ptr<ASTNode> val = nullptr;
         if (peek().type != TOK_RBRACE && peek().type != TOK_EOF) val = expression();
         if (check(TOK_SEMICOLON)) advance();
-        return std::make_shared<ReturnNode>(val);
+        auto ret = std::make_shared<ReturnNode>(val);
+        ret->tailPosition = tryDepth == 0;
+        return ret;
     }
     std::shared_ptr<ASTNode> tryStmt() {
         consume(TOK_TRY, "Expect try");
         consume(TOK_LBRACE, "Expect {");
+        tryDepth++;
         auto tryB = block();
+        tryDepth--;
         consume(TOK_CATCH, "Expect catch");
         consume(TOK_LPAREN, "Expect (");
         std::string v = consume(TOK_ID, "Expect var").text;
@@ -902,12 +3872,38 @@ public:
     }
     std::shared_ptr<ASTNode> expression() { return assignment(); }
     std::shared_ptr<ASTNode> assignment() {
-        auto expr = equality();
+        auto expr = bitwiseOr();
         if (check(TOK_EQUALS)) {
             advance();
             auto val = assignment();
             if (auto v = std::dynamic_pointer_cast<VariableNode>(expr)) return std::make_shared<AssignmentNode>(v->name, val);
             if (auto p = std::dynamic_pointer_cast<PropertyGetNode>(expr)) return std::make_shared<PropertySetNode>(p->obj, p->prop, val);
+            if (auto i = std::dynamic_pointer_cast<IndexNode>(expr)) return std::make_shared<IndexSetNode>(i->obj, i->index, val);
+        }
+        return expr;
+    }
+    // Bitwise operators bind looser than equality and shifts tighter than comparison, as in C.
+    std::shared_ptr<ASTNode> bitwiseOr() {
+        auto expr = bitwiseXor();
+        while (check(TOK_PIPE)) {
+            std::string op = advance().text;
+            expr = std::make_shared<BinaryOpNode>(op, expr, bitwiseXor());
+        }
+        return expr;
+    }
+    std::shared_ptr<ASTNode> bitwiseXor() {
+        auto expr = bitwiseAnd();
+        while (check(TOK_CARET)) {
+            std::string op = advance().text;
+            expr = std::make_shared<BinaryOpNode>(op, expr, bitwiseAnd());
+        }
+        return expr;
+    }
+    std::shared_ptr<ASTNode> bitwiseAnd() {
+        auto expr = equality();
+        while (check(TOK_AMP)) {
+            std::string op = advance().text;
+            expr = std::make_shared<BinaryOpNode>(op, expr, equality());
         }
         return expr;
     }
@@ -920,8 +3916,16 @@ public:
         return expr;
     }
     std::shared_ptr<ASTNode> comparison() {
-        auto expr = term();
+        auto expr = shift();
         while (check(TOK_LT) || check(TOK_GT)) {
+            std::string op = advance().text;
+            expr = std::make_shared<BinaryOpNode>(op, expr, shift());
+        }
+        return expr;
+    }
+    std::shared_ptr<ASTNode> shift() {
+        auto expr = term();
+        while (check(TOK_SHL) || check(TOK_SHR)) {
             std::string op = advance().text;
             expr = std::make_shared<BinaryOpNode>(op, expr, term());
         }
@@ -943,7 +3947,13 @@ public:
         }
         return expr;
     }
-    std::shared_ptr<ASTNode> unary() { return call(); }
+    std::shared_ptr<ASTNode> unary() {
+        if (check(TOK_AWAIT)) {
+            advance();
+            return std::make_shared<AwaitNode>(unary());
+        }
+        return call();
+    }
     std::shared_ptr<ASTNode> call() {
         auto expr = primary();
         while (true) {
@@ -959,6 +3969,11 @@ public:
                 advance();
                 std::string prop = consume(TOK_ID, "Expect property").text;
                 expr = std::make_shared<PropertyGetNode>(expr, prop);
+            } else if (check(TOK_LBRACKET)) {
+                advance();
+                auto index = expression();
+                consume(TOK_RBRACKET, "Expect ]");
+                expr = std::make_shared<IndexNode>(expr, index);
             } else {
                 break;
             }
@@ -977,11 +3992,19 @@ public:
             consume(TOK_RPAREN, "Expect )");
             return std::make_shared<InstanceCreation>(className, args);
         }
-        if (check(TOK_FALSE)) { advance(); return std::make_shared<NumberNode>(0); }
-        if (check(TOK_TRUE)) { advance(); return std::make_shared<NumberNode>(1); }
-        if (check(TOK_NULL)) { advance(); return std::make_shared<StringNode>("null"); }
+        if (check(TOK_FALSE)) { advance(); return std::make_shared<NumberNode>(NumberObject::integer(0)); }
+        if (check(TOK_TRUE)) { advance(); return std::make_shared<NumberNode>(NumberObject::integer(1)); }
+        if (check(TOK_NULL)) { advance(); return std::make_shared<ConstantNode>(VOID_INSTANCE); }
         if (check(TOK_THIS)) { advance(); return std::make_shared<ThisNode>(); }
-        if (check(TOK_NUMBER)) return std::make_shared<NumberNode>(std::stod(advance().text));
+        if (check(TOK_NUMBER)) {
+            std::string text = advance().text;
+            int64_t exact;
+            if (text.find('.') == std::string::npos) {
+                auto parsed = std::from_chars(text.data(), text.data() + text.size(), exact);
+                if (parsed.ec == std::errc()) return std::make_shared<NumberNode>(NumberObject::integer(exact));
+            }
+            return std::make_shared<NumberNode>(std::stod(text));
+        }
         if (check(TOK_STRING_LIT)) return std::make_shared<StringNode>(advance().text);
         if (check(TOK_ID)) {
             return std::make_shared<VariableNode>(advance().text);
@@ -1005,21 +4028,973 @@ public:
         return nullptr;
     }
 };
-int main(int argc, char* argv[]) {
-    if (argc < 2) { std::cerr << "Usage: ulang file.ul\n"; return 1; }
-    std::ifstream f(argv[1]);
-    std::stringstream buff;
-    buff << f.rdbuf();
+class Optimizer {
+    Interpreter& interpreter;
+    bool dumpAst;
+    // When statements are optimised one at a time, a later statement may still rebind a builtin.
+    bool wholeProgram;
+    std::set<std::string> programBindings;
+public:
+    Optimizer(Interpreter& i, bool dump, bool whole = true) : interpreter(i), dumpAst(dump), wholeProgram(whole) {}
+    static void dump(const std::shared_ptr<ASTNode>& node, int depth) {
+        std::cerr << std::string(depth * 2, ' ') << node->describe() << "\n";
+        node->children([depth](std::shared_ptr<ASTNode>& child) { dump(child, depth + 1); });
+    }
+    static void dumpProgram(const std::string& title, const std::vector<std::shared_ptr<ASTNode>>& program) {
+        std::cerr << "=== AST " << title << " ===\n";
+        for (auto& stmt : program) dump(stmt, 0);
+    }
+    static std::shared_ptr<ULangObject> constantOf(const std::shared_ptr<ASTNode>& node) {
+        if (auto c = std::dynamic_pointer_cast<ConstantNode>(node)) return c->value;
+        return nullptr;
+    }
+    // Every name the node (re)binds: assignments, declarations, loop and catch variables, parameters.
+    // Without assignments, only the names that are always bound in the current scope.
+    static void collectBindings(const std::shared_ptr<ASTNode>& node, std::set<std::string>& names, bool assignments = true) {
+        if (auto a = std::dynamic_pointer_cast<AssignmentNode>(node)) { if (assignments) names.insert(a->name); }
+        else if (auto v = std::dynamic_pointer_cast<VarDeclNode>(node)) names.insert(v->name);
+        else if (auto f = std::dynamic_pointer_cast<ForNode>(node)) names.insert(f->varName);
+        else if (auto t = std::dynamic_pointer_cast<TryCatchNode>(node)) names.insert(t->catchVar);
+        else if (auto c = std::dynamic_pointer_cast<ClassNode>(node)) {
+            names.insert(c->name);
+            for (auto& m : c->methods) names.insert(m.second->params.begin(), m.second->params.end());
+        } else if (auto fn = std::dynamic_pointer_cast<FunctionDeclNode>(node)) {
+            names.insert(fn->name);
+            names.insert(fn->params.begin(), fn->params.end());
+        } else if (auto i = std::dynamic_pointer_cast<ImportNode>(node)) names.insert(i->alias);
+        else if (auto f = std::dynamic_pointer_cast<FromImportNode>(node)) {
+            for (auto& n : f->names) names.insert(n.second);
+        }
+        node->children([&names, assignments](std::shared_ptr<ASTNode>& child) { collectBindings(child, names, assignments); });
+    }
+    static bool containsCall(const std::shared_ptr<ASTNode>& node) {
+        // An await lets other tasks run, which may rebind anything.
+        if (std::dynamic_pointer_cast<CallNode>(node) || std::dynamic_pointer_cast<InstanceCreation>(node) || std::dynamic_pointer_cast<AwaitNode>(node)) return true;
+        bool found = false;
+        node->children([&found](std::shared_ptr<ASTNode>& child) { if (!found) found = containsCall(child); });
+        return found;
+    }
+    // `l[i] = v` and `o.p = v` change a value in place; any variable may name it, so no name is safe.
+    static bool containsMutation(const std::shared_ptr<ASTNode>& node) {
+        if (std::dynamic_pointer_cast<IndexSetNode>(node) || std::dynamic_pointer_cast<PropertySetNode>(node)) return true;
+        bool found = false;
+        node->children([&found](std::shared_ptr<ASTNode>& child) { if (!found) found = containsMutation(child); });
+        return found;
+    }
+    // Builtins are only treated as pure when the program never rebinds their name.
+    bool isPureBuiltinCall(const std::shared_ptr<CallNode>& call, const std::string& name) const {
+        auto v = std::dynamic_pointer_cast<VariableNode>(call->callee);
+        return wholeProgram && v && v->name == name && !programBindings.count(name);
+    }
+
+    // Pass 1: evaluate operators and pure builtin calls whose operands are all constants.
+    std::shared_ptr<ASTNode> fold(std::shared_ptr<ASTNode> node) {
+        node->children([this](std::shared_ptr<ASTNode>& child) { child = fold(child); });
+        bool foldable = false;
+        if (auto b = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+            foldable = constantOf(b->left) && constantOf(b->right);
+        } else if (auto c = std::dynamic_pointer_cast<CallNode>(node)) {
+            if (isPureBuiltinCall(c, "pow") || isPureBuiltinCall(c, "floor")) {
+                foldable = true;
+                for (auto& a : c->args) if (!constantOf(a)) foldable = false;
+            }
+        }
+        if (!foldable) return node;
+        try {
+            return std::make_shared<ConstantNode>(node->evaluate(interpreter));
+        } catch (ULangError&) {
+            return node; // leave it for the runtime to report with the right position
+        }
+    }
+    // Pass 2: x * 2, 2 * x and pow(x, 2) become cheaper single-operand nodes.
+    std::shared_ptr<ASTNode> strengthReduce(std::shared_ptr<ASTNode> node) {
+        node->children([this](std::shared_ptr<ASTNode>& child) { child = strengthReduce(child); });
+        auto isTwo = [](const std::shared_ptr<ASTNode>& n) {
+            auto c = constantOf(n);
+            return c && c->type == ULangObject::NUMBER && c->toDouble() == 2.0;
+        };
+        if (auto b = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+            if (b->op == "*" && isTwo(b->right)) return std::make_shared<StrengthReducedNode>(StrengthReducedNode::TWICE, b->left);
+            if (b->op == "*" && isTwo(b->left)) return std::make_shared<StrengthReducedNode>(StrengthReducedNode::TWICE, b->right);
+        } else if (auto c = std::dynamic_pointer_cast<CallNode>(node)) {
+            if (isPureBuiltinCall(c, "pow") && c->args.size() == 2 && isTwo(c->args[1]))
+                return std::make_shared<StrengthReducedNode>(StrengthReducedNode::SQUARE, c->args[0]);
+        }
+        return node;
+    }
+    // Pass 3: drop branches and loops with constant conditions, and statements after a return.
+    std::shared_ptr<ASTNode> eliminateDeadCode(std::shared_ptr<ASTNode> node) {
+        node->children([this](std::shared_ptr<ASTNode>& child) { child = eliminateDeadCode(child); });
+        if (auto i = std::dynamic_pointer_cast<IfNode>(node)) {
+            if (auto c = constantOf(i->condition)) {
+                if (c->isTruthy()) return i->thenBlock;
+                if (i->elseBlock) return i->elseBlock;
+                return std::make_shared<ConstantNode>(VOID_INSTANCE);
+            }
+        } else if (auto w = std::dynamic_pointer_cast<WhileNode>(node)) {
+            auto c = constantOf(w->condition);
+            if (c && !c->isTruthy()) return std::make_shared<ConstantNode>(VOID_INSTANCE);
+        } else if (auto b = std::dynamic_pointer_cast<BlockNode>(node)) {
+            pruneStatements(b->statements);
+        } else if (auto c = std::dynamic_pointer_cast<ClassNode>(node)) {
+            for (auto& m : c->methods) pruneStatements(m.second->body);
+        }
+        return node;
+    }
+    // The last statement of a function body is its implicit result, so it is always kept.
+    static void pruneStatements(std::vector<std::shared_ptr<ASTNode>>& stmts) {
+        std::vector<std::shared_ptr<ASTNode>> kept;
+        for (size_t i = 0; i < stmts.size(); ++i) {
+            bool last = i + 1 == stmts.size();
+            if (!last && constantOf(stmts[i])) continue;
+            kept.push_back(stmts[i]);
+            if (std::dynamic_pointer_cast<ReturnNode>(stmts[i])) break;
+        }
+        stmts.swap(kept);
+    }
+    // Pass 4: cache pure expressions whose variables a loop never rebinds. Loops that call
+    // anything are skipped, since a callee could rebind globals behind our back, and so are loops
+    // that store into a list, bytes or object, since the stored-to value may be aliased.
+    std::shared_ptr<ASTNode> hoistInvariants(std::shared_ptr<ASTNode> node) {
+        std::shared_ptr<ASTNode> condition, body;
+        std::vector<std::shared_ptr<InvariantNode>>* invariants = nullptr;
+        std::set<std::string> rebound;
+        if (auto w = std::dynamic_pointer_cast<WhileNode>(node)) {
+            condition = w->condition; body = w->body; invariants = &w->invariants;
+        } else if (auto f = std::dynamic_pointer_cast<ForNode>(node)) {
+            body = f->body; invariants = &f->invariants; rebound.insert(f->varName);
+        }
+        if (invariants && !containsCall(body) && !(condition && containsCall(condition)) && !containsMutation(body)) {
+            collectBindings(body, rebound);
+            if (condition) collectBindings(condition, rebound);
+            std::function<void(std::shared_ptr<ASTNode>&)> hoist = [&](std::shared_ptr<ASTNode>& child) {
+                if (isWorthHoisting(child) && isInvariant(child, rebound)) {
+                    auto inv = std::make_shared<InvariantNode>(child);
+                    invariants->push_back(inv);
+                    child = inv;
+                    return;
+                }
+                if (std::dynamic_pointer_cast<FunctionDeclNode>(child) || std::dynamic_pointer_cast<ClassNode>(child)) return;
+                child->children(hoist);
+            };
+            node->children(hoist);
+        }
+        node->children([this](std::shared_ptr<ASTNode>& child) { child = hoistInvariants(child); });
+        return node;
+    }
+    static bool isWorthHoisting(const std::shared_ptr<ASTNode>& node) {
+        return std::dynamic_pointer_cast<BinaryOpNode>(node) || std::dynamic_pointer_cast<StrengthReducedNode>(node);
+    }
+    static bool isInvariant(const std::shared_ptr<ASTNode>& node, const std::set<std::string>& rebound) {
+        if (std::dynamic_pointer_cast<ConstantNode>(node) || std::dynamic_pointer_cast<InvariantNode>(node)) return true;
+        if (auto v = std::dynamic_pointer_cast<VariableNode>(node)) return !rebound.count(v->name);
+        if (!isWorthHoisting(node)) return false;
+        bool invariant = true;
+        node->children([&](std::shared_ptr<ASTNode>& child) { if (invariant) invariant = isInvariant(child, rebound); });
+        return invariant;
+    }
+
+    std::vector<std::shared_ptr<ASTNode>> run(std::vector<std::shared_ptr<ASTNode>> program) {
+        programBindings.clear();
+        for (auto& stmt : program) collectBindings(stmt, programBindings);
+        using Pass = std::shared_ptr<ASTNode> (Optimizer::*)(std::shared_ptr<ASTNode>);
+        const std::vector<std::pair<std::string, Pass>> passes = {
+            {"fold", &Optimizer::fold},
+            {"strength-reduce", &Optimizer::strengthReduce},
+            {"dead-code", &Optimizer::eliminateDeadCode},
+            {"hoist-invariants", &Optimizer::hoistInvariants},
+        };
+        for (auto& pass : passes) {
+            if (dumpAst) dumpProgram("before " + pass.first, program);
+            for (auto& stmt : program) stmt = (this->*pass.second)(stmt);
+            pruneTopLevel(program);
+            if (dumpAst) dumpProgram("after " + pass.first, program);
+        }
+        return program;
+    }
+    // A function body parsed after the program started; unlike run(), its statements are not pruned.
+    std::vector<std::shared_ptr<ASTNode>> runOnBody(std::vector<std::shared_ptr<ASTNode>> body) {
+        std::shared_ptr<ASTNode> block = std::make_shared<BlockNode>(std::move(body));
+        for (auto pass : {&Optimizer::fold, &Optimizer::strengthReduce, &Optimizer::eliminateDeadCode, &Optimizer::hoistInvariants}) {
+            block = (this->*pass)(block);
+        }
+        if (auto b = std::dynamic_pointer_cast<BlockNode>(block)) return b->statements;
+        return {block};
+    }
+    // Top-level statement results are discarded, so constants there can always go.
+    static void pruneTopLevel(std::vector<std::shared_ptr<ASTNode>>& program) {
+        program.erase(std::remove_if(program.begin(), program.end(),
+            [](const std::shared_ptr<ASTNode>& n) { return constantOf(n) != nullptr; }), program.end());
+    }
+};
+// Returns why a memoised function is not pure, or an empty string. Free variables may only name the
+// function itself or a side-effect-free builtin; `this`, other globals and I/O builtins are rejected.
+// An assignment rebinds whatever variable of that name is visible, so its name only counts as local
+// once the body has assigned it without reading it first; reading it earlier is a global read.
+std::string findImpurity(const FunctionObject& fn) {
+    static const std::set<std::string> pureBuiltins = {"pow", "floor", "len"};
+    static const std::set<std::string> ioBuiltins = {"output", "drawGraph", "http_get", "http_post", "http_get_async", "http_post_async", "sleep", "gather", "cancel", "read_file", "read_bytes", "write_file", "read_csv"};
+    std::set<std::string> locals(fn.params.begin(), fn.params.end());
+    for (auto& stmt : fn.body) Optimizer::collectBindings(stmt, locals, false);
+    std::string reason;
+    std::function<void(std::shared_ptr<ASTNode>&)> visit = [&](std::shared_ptr<ASTNode>& node) {
+        if (!reason.empty()) return;
+        if (std::dynamic_pointer_cast<ThisNode>(node)) { reason = "uses 'this'"; return; }
+        if (auto a = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+            node->children(visit);
+            locals.insert(a->name);
+            return;
+        }
+        if (auto v = std::dynamic_pointer_cast<VariableNode>(node)) {
+            if (locals.count(v->name) || v->name == fn.name || pureBuiltins.count(v->name)) return;
+            reason = ioBuiltins.count(v->name) ? "performs I/O via '" + v->name + "'" : "reads global '" + v->name + "'";
+            return;
+        }
+        node->children(visit);
+    };
+    for (auto stmt : fn.body) visit(stmt);
+    return reason;
+}
+void Interpreter::memoize(const std::shared_ptr<FunctionObject>& fn, size_t capacity, bool checkPurity) {
+    if (checkPurity) {
+        fn->ensureParsed(*this);
+        std::string reason = findImpurity(*fn);
+        if (!reason.empty()) throw_runtime_error("Cannot memoise impure function '" + fn->name + "': it " + reason + ".");
+    }
+    fn->memo = std::make_shared<MemoCache>(fn->name, capacity);
+    memoCaches.push_back(fn->memo);
+}
+const std::vector<std::shared_ptr<ASTNode>>& LazyBody::parse(Interpreter& interpreter) {
+    if (parsed) return statements;
+    // Runtime errors report the lexer's position, so the caller's is put back afterwards.
+    int savedLine = current_line, savedColumn = current_column;
+    try {
+        Lexer lexer(readString(source), line, column);
+        Parser parser(lexer, true);
+        statements = Optimizer(interpreter, false, false).runOnBody(parser.parse());
+    } catch (...) {
+        current_line = savedLine;
+        current_column = savedColumn;
+        throw;
+    }
+    current_line = savedLine;
+    current_column = savedColumn;
+    parsed = true;
+    source = std::string();
+    interpreter.tracer.lazyBodiesParsed++;
+    return statements;
+}
+// Parsed and optimised top-level code of each module file, shared by every interpreter in the process.
+// Entries are checked against the file's size and mtime, so editing one module recompiles only it.
+struct CompiledModule {
+    off_t size = 0;
+    struct timespec mtime{};
+    std::vector<std::shared_ptr<ASTNode>> program;
+};
+static std::unordered_map<std::string, std::shared_ptr<CompiledModule>> compiledModules;
+std::string Interpreter::findModule(const std::string& spec) {
+    std::string file = spec;
+    if (file.size() < 3 || file.compare(file.size() - 3, 3, ".ul") != 0) file += ".ul";
+    std::vector<std::string> dirs;
+    if (file[0] == '/') {
+        dirs.push_back("");
+    } else {
+        const std::string& from = module->path;
+        size_t slash = from.find_last_of('/');
+        dirs.push_back(slash == std::string::npos ? "." : from.substr(0, slash));
+        dirs.insert(dirs.end(), searchPath.begin(), searchPath.end());
+    }
+    char resolved[PATH_MAX];
+    for (auto& dir : dirs) {
+        std::string candidate = dir.empty() ? file : dir + "/" + file;
+        if (realpath(candidate.c_str(), resolved)) return resolved;
+    }
+    throw_runtime_error("Module '" + spec + "' not found");
+    return "";
+}
+std::shared_ptr<ModuleObject> Interpreter::importModule(const std::string& spec) {
+    std::string path = findModule(spec);
+    // A module still loading is returned as is, so import cycles see it partly initialised.
+    auto loaded = modules.find(path);
+    if (loaded != modules.end()) return loaded->second;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) throw_runtime_error("Cannot read module '" + path + "'");
+    auto& cached = compiledModules[path];
+    if (!cached || cached->size != st.st_size || cached->mtime.tv_sec != st.st_mtim.tv_sec || cached->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw_runtime_error("Cannot read module '" + path + "'");
+        int savedLine = current_line, savedColumn = current_column;
+        auto compiled = std::make_shared<CompiledModule>();
+        try {
+            Lexer lexer(readStream(in));
+            Parser parser(lexer, true);
+            compiled->program = Optimizer(*this, false, false).run(parser.parse());
+        } catch (ULangError& e) {
+            current_line = savedLine;
+            current_column = savedColumn;
+            throw ULangError(std::string(e.what()) + " (in module " + path + ", line " + std::to_string(e.line) + ")", e.type, e.line, e.column, true);
+        }
+        current_line = savedLine;
+        current_column = savedColumn;
+        compiled->size = st.st_size;
+        compiled->mtime = st.st_mtim;
+        cached = compiled;
+        tracer.modulesCompiled++;
+    }
+    auto compiled = cached;
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    if (name.size() > 3) name.resize(name.size() - 3);
+    auto loading = std::make_shared<ModuleObject>(name, path);
+    modules[path] = loading;
+    // The module's top level runs in a fresh state of its own, as if it were the main program.
+    ExecutionState state;
+    state.module = loading.get();
+    state.callDepth = callDepth;
+    state.nativeStackBase = nativeStackBase;
+    state.nativeStackSize = nativeStackSize;
+    swapState(state);
     try {
-        auto tokens = tokenize(buff.str());
-        Parser parser(tokens);
-        auto nodes = parser.parse();
+        executeBlock(compiled->program);
+    } catch (...) {
+        swapState(state);
+        modules.erase(path);
+        throw;
+    }
+    swapState(state);
+    tracer.modulesLoaded++;
+    return loading;
+}
+// Native stack reserved per permitted ULang call level; a call nests several evaluate() frames.
+const size_t NATIVE_STACK_PER_CALL = 8 * 1024;
+// Runs fn on a thread whose stack is mapped on demand from the heap, sized for the call depth limit.
+// Falls back to the current thread if such a thread cannot be created.
+void runOnInterpreterStack(size_t bytes, const std::function<void(const char*, size_t)>& fn) {
+    struct Job { const std::function<void(const char*, size_t)>* fn; size_t bytes; } job{&fn, bytes};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_t thread;
+    bool started = pthread_attr_setstacksize(&attr, bytes) == 0 &&
+        pthread_create(&thread, &attr, [](void* p) -> void* {
+            auto job = static_cast<Job*>(p);
+            char base = 0;
+            (*job->fn)(&base, job->bytes);
+            return nullptr;
+        }, &job) == 0;
+    pthread_attr_destroy(&attr);
+    if (started) pthread_join(thread, nullptr);
+    else fn(nullptr, 0);
+}
+// A whole, non-negative option value; false for anything else, including overflow.
+template <typename T> bool parseCount(const std::string& text, T& out) {
+    const char* end = text.data() + text.size();
+    auto parsed = std::from_chars(text.data(), end, out);
+    return !text.empty() && parsed.ec == std::errc() && parsed.ptr == end;
+}
+// "512K", "64M", "2G" or a plain byte count.
+bool parseByteSize(const std::string& text, size_t& out) {
+    int shift = 0;
+    switch (text.empty() ? 0 : std::toupper((unsigned char)text.back())) {
+        case 'K': shift = 10; break;
+        case 'M': shift = 20; break;
+        case 'G': shift = 30; break;
+    }
+    size_t n;
+    if (!parseCount(shift ? text.substr(0, text.size() - 1) : text, n) || n > (SIZE_MAX >> shift)) return false;
+    out = n << shift;
+    return true;
+}
+// --serve: a supervisor process accepts jobs on a Unix socket and hands them to N forked worker
+// processes, each holding a warm interpreter with the script already loaded. Workers are processes,
+// not threads, because the interpreter keeps per-process state (current_line, the heap counter).
+//
+// Every message is a frame: u32 payload length, u8 type, payload. Integers are little-endian; a
+// string is a u32 length and its bytes; a value is a tag followed by its data: 'n' null, 'b' u8,
+// 'i' int64, 'd' double, 's' string, 'y' bytes, 'l' u32 count and that many values.
+//   client -> server  'J' u32 id, u32 timeout ms (0: the --timeout default), string entry, u32 argc, values
+//                     'M' (empty): metrics
+//   server -> client  'O' u32 id, bytes printed by the job (zero or more, streamed as printed)
+//                     'R' u32 id, value returned      'E' u32 id, string type, string message, u32 line
+//                     'M' metrics as "name value" lines
+void putU32(std::string& out, uint32_t v) { char b[4]; std::memcpy(b, &v, 4); out.append(b, 4); }
+void putString(std::string& out, std::string_view s) { putU32(out, (uint32_t)s.size()); out.append(s.data(), s.size()); }
+void putValue(std::string& out, const std::shared_ptr<ULangObject>& v, int depth = 0) {
+    char b[8];
+    switch (v->type) {
+        case ULangObject::VAL_VOID: out += 'n'; return;
+        case ULangObject::BOOLEAN: out += 'b'; out += (char)v->isTruthy(); return;
+        case ULangObject::NUMBER: {
+            auto n = static_cast<NumberObject*>(v.get());
+            out += n->isInt ? 'i' : 'd';
+            if (n->isInt) std::memcpy(b, &n->ivalue, 8); else std::memcpy(b, &n->value, 8);
+            out.append(b, 8);
+            return;
+        }
+        case ULangObject::STRING: out += 's'; putString(out, static_cast<StringObject*>(v.get())->view()); return;
+        case ULangObject::BYTES: out += 'y'; putString(out, static_cast<BytesObject*>(v.get())->data); return;
+        case ULangObject::LIST:
+            if (depth < 64) {
+                auto& elements = static_cast<ListObject*>(v.get())->elements;
+                out += 'l';
+                putU32(out, (uint32_t)elements.size());
+                for (auto& e : elements) putValue(out, e, depth + 1);
+                return;
+            }
+            break;
+        default: break;
+    }
+    out += 's';
+    putString(out, v->toString());
+}
+std::string makeFrame(char type, std::string_view payload) {
+    std::string f;
+    putU32(f, (uint32_t)payload.size());
+    f += type;
+    f.append(payload.data(), payload.size());
+    return f;
+}
+struct WireReader {
+    const char* p;
+    const char* end;
+    const char* take(size_t n) {
+        if ((size_t)(end - p) < n) throw_runtime_error("Malformed request frame");
+        const char* at = p;
+        p += n;
+        return at;
+    }
+    uint32_t u32() { uint32_t v; std::memcpy(&v, take(4), 4); return v; }
+    std::string_view str() { uint32_t n = u32(); return std::string_view(take(n), n); }
+    std::shared_ptr<ULangObject> value(int depth = 0) {
+        char tag = *take(1);
+        switch (tag) {
+            case 'n': return VOID_INSTANCE;
+            case 'b': return std::make_shared<BooleanObject>(*take(1) != 0);
+            case 'i': { int64_t v; std::memcpy(&v, take(8), 8); return NumberObject::integer(v); }
+            case 'd': { double v; std::memcpy(&v, take(8), 8); return std::make_shared<NumberObject>(v); }
+            case 's': return std::make_shared<StringObject>(std::string(str()));
+            case 'y': return std::make_shared<BytesObject>(std::string(str()));
+            case 'l': {
+                if (depth >= 64) break;
+                uint32_t n = u32();
+                std::vector<std::shared_ptr<ULangObject>> elements;
+                for (uint32_t i = 0; i < n; ++i) elements.push_back(value(depth + 1));
+                return std::make_shared<ListObject>(elements);
+            }
+        }
+        throw_runtime_error("Malformed value in request frame");
+    }
+};
+// Splits the first complete frame off buf; false when buf does not hold one yet.
+bool takeFrame(std::string& buf, char& type, std::string& payload) {
+    if (buf.size() < 5) return false;
+    uint32_t n;
+    std::memcpy(&n, buf.data(), 4);
+    if (buf.size() < 5 + (size_t)n) return false;
+    type = buf[4];
+    payload.assign(buf, 5, n);
+    buf.erase(0, 5 + (size_t)n);
+    return true;
+}
+bool writeAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+bool readFrame(int fd, std::string& buf, char& type, std::string& payload) {
+    char chunk[65536];
+    while (!takeFrame(buf, type, payload)) {
+        ssize_t n = read(fd, chunk, sizeof chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf.append(chunk, (size_t)n);
+    }
+    return true;
+}
+// What a job prints goes to the supervisor as 'O' frames rather than to the worker's stdout.
+class OutputFrameBuf : public std::streambuf {
+    int fd;
+    std::string pending;
+protected:
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) { pending += (char)c; if (pending.size() >= 65536) sync(); }
+        return c;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        pending.append(s, (size_t)n);
+        if (pending.size() >= 65536) sync();
+        return n;
+    }
+    int sync() override {
+        if (!pending.empty()) writeAll(fd, makeFrame('O', pending));
+        pending.clear();
+        return 0;
+    }
+public:
+    explicit OutputFrameBuf(int f) : fd(f) {}
+};
+struct ServeOptions {
+    std::string socketPath, scriptPath;
+    unsigned workers = 0;
+    bool optimize = true;
+    size_t maxDepth = 10000;
+    ResourceLimits limits;
+    std::vector<std::string> searchPath;
+};
+// A worker loads the script once, reports 'W' (ready) or 'X' (cannot load), then runs jobs until its
+// socket closes. Each job runs in a fork of the loaded worker that exits after replying, so every job
+// starts from the state the script left, whatever the previous one changed, and the fork only
+// copies the pages a job writes.
+void runWorker(int fd, const ServeOptions& options) {
+    size_t stackBytes = std::max<size_t>(64 * 1024 * 1024, options.maxDepth * NATIVE_STACK_PER_CALL);
+    runOnInterpreterStack(stackBytes, [&](const char* stackBase, size_t stackSize) {
         Interpreter interpreter;
-        interpreter.executeBlock(nodes);
-    } catch (ULangError& e) {
-        std::cerr << e.getFullMessage() << "\n";
-    } catch (std::exception& e) {
-        std::cerr << "INTERNAL ERROR: " << e.what() << "\n";
+        interpreter.searchPath = options.searchPath;
+        char resolved[PATH_MAX];
+        if (realpath(options.scriptPath.c_str(), resolved)) interpreter.mainModule->path = resolved;
+        interpreter.nativeStackBase = stackBase;
+        interpreter.nativeStackSize = stackSize;
+        interpreter.flushEachLine = true;
+        std::vector<std::shared_ptr<ASTNode>> program;
+        try {
+            std::ifstream in(options.scriptPath, std::ios::binary);
+            if (!in) throw_runtime_error("Cannot open " + options.scriptPath);
+            Lexer lexer(readStream(in));
+            Parser parser(lexer);
+            program = parser.parse();
+            if (options.optimize) program = Optimizer(interpreter, false).run(program);
+            interpreter.executeBlock(program);
+            interpreter.loop.run();
+        } catch (ULangError& e) {
+            writeAll(fd, makeFrame('X', e.getFullMessage()));
+            return;
+        }
+        std::cout.flush();
+        OutputFrameBuf frames(fd);
+        std::cout.rdbuf(&frames);
+        writeAll(fd, makeFrame('W', ""));
+        pid_t self = getpid();
+        // The process for the next job is forked while the worker waits for that job and reads the
+        // frame itself, so the fork stays out of the job's latency; the loaded worker only waits for it.
+        while (true) {
+            pid_t child = fork();
+            if (child < 0) break;
+            if (child > 0) {
+                int status = 0;
+                if (waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+                // The socket closed, or a job's process died and may have left a frame half read:
+                // exiting lets the supervisor fail the job and start a fresh worker.
+                break;
+            }
+            // A worker killed at a hard timeout takes its running job with it.
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != self) _exit(1);
+            std::string buf, payload, reply;
+            char type;
+            do { if (!readFrame(fd, buf, type, payload)) _exit(1); } while (type != 'J');
+            current_line = current_column = 0;
+            try {
+                WireReader reader{payload.data(), payload.data() + payload.size()};
+                reader.u32();
+                ResourceLimits limits = options.limits;
+                limits.maxDepth = options.maxDepth;
+                if (uint32_t timeout = reader.u32()) limits.timeoutMs = timeout;
+                std::string entry(reader.str());
+                std::vector<std::shared_ptr<ULangObject>> args(reader.u32());
+                for (auto& a : args) a = reader.value();
+                interpreter.setLimits(limits);
+                auto found = interpreter.mainModule->globals.find(entry);
+                if (found == interpreter.mainModule->globals.end()) throw_runtime_error("No function '" + entry + "' in " + options.scriptPath);
+                std::shared_ptr<ULangObject> result;
+                if (found->second->type == ULangObject::FUNCTION)
+                    result = static_cast<FunctionObject*>(found->second.get())->invoke(interpreter, ArgList(args), nullptr);
+                else if (found->second->type == ULangObject::BUILTIN)
+                    result = static_cast<BuiltinFunction*>(found->second.get())->call(interpreter, ArgList(args));
+                else throw_runtime_error("'" + entry + "' is not a function");
+                if (result->type == ULangObject::TASK) result = interpreter.loop.await(std::static_pointer_cast<TaskObject>(result));
+                interpreter.loop.run();
+                reply = "R";
+                putValue(reply, result);
+            } catch (const ULangError& e) {
+                reply = "E";
+                putString(reply, e.type);
+                putString(reply, e.what());
+                putU32(reply, (uint32_t)e.line);
+            } catch (const std::exception& e) {
+                reply = "E";
+                putString(reply, "Runtime");
+                putString(reply, e.what());
+                putU32(reply, 0);
+            }
+            std::cout.flush();
+            bool sent = writeAll(fd, makeFrame(reply[0], std::string_view(reply).substr(1)));
+            // Let the supervisor pass the reply on before this exit and the next fork take the CPU.
+            sched_yield();
+            _exit(sent ? 0 : 1);
+        }
+        std::cout.rdbuf(nullptr);
+    });
+}
+static volatile sig_atomic_t serveStopping = 0;
+int serveJobs(const ServeOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    auto nowUs = []() { return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count(); };
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, [](int) { serveStopping = 1; });
+    signal(SIGTERM, [](int) { serveStopping = 1; });
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (options.socketPath.size() >= sizeof(addr.sun_path)) { std::cerr << "Socket path too long: " << options.socketPath << "\n"; return 1; }
+    std::strcpy(addr.sun_path, options.socketPath.c_str());
+    unlink(options.socketPath.c_str());
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof addr) < 0 || listen(listener, 128) < 0) {
+        std::cerr << "Cannot listen on " << options.socketPath << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    // Clients are keyed by a serial number rather than their fd, which the kernel reuses as soon as a
+    // connection closes; a job outliving its client must not reply to whoever gets the fd next.
+    struct Client { int fd; std::string in, out; };
+    struct Job { uint64_t client; uint32_t id, timeoutMs; std::string payload; uint64_t receivedUs; };
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        bool ready = false, killed = false;
+        std::string in, out;
+        std::optional<Job> job;
+        uint64_t startedUs = 0;
+    };
+    std::map<uint64_t, Client> clients;
+    uint64_t nextClient = 0;
+    std::deque<Job> queue;
+    std::vector<Worker> workers(options.workers);
+    // Completed jobs' latency (receipt to result) and queue wait, over the last 1024 jobs.
+    std::vector<uint64_t> latencies, waits;
+    size_t sampleAt = 0;
+    uint64_t received = 0, completed = 0, failed = 0, restarts = 0;
+    auto spawn = [&](Worker& w) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) return false;
+        pid_t pid = fork();
+        if (pid < 0) { close(pair[0]); close(pair[1]); return false; }
+        if (pid == 0) {
+            close(pair[0]);
+            close(listener);
+            for (auto& c : clients) close(c.second.fd);
+            for (auto& other : workers) if (other.fd >= 0) close(other.fd);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            runWorker(pair[1], options);
+            std::cout.flush();
+            _exit(0);
+        }
+        close(pair[1]);
+        fcntl(pair[0], F_SETFL, O_NONBLOCK);
+        w = Worker();
+        w.pid = pid;
+        w.fd = pair[0];
+        return true;
+    };
+    auto send = [&](uint64_t client, char type, uint32_t id, std::string_view body) {
+        auto it = clients.find(client);
+        if (it == clients.end()) return;
+        std::string payload;
+        putU32(payload, id);
+        payload.append(body.data(), body.size());
+        it->second.out += makeFrame(type, payload);
+    };
+    // The worker socket is non-blocking, so a large job goes out over several polls.
+    auto flushWorker = [&](Worker& w) {
+        while (!w.out.empty()) {
+            ssize_t n = write(w.fd, w.out.data(), w.out.size());
+            if (n > 0) { w.out.erase(0, (size_t)n); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            // EAGAIN waits for POLLOUT; any other error shows up as a hangup when the worker is read.
+            if (n == 0 || errno != EAGAIN) w.out.clear();
+            break;
+        }
+    };
+    auto finish = [&](Worker& w, char type, std::string_view body) {
+        Job& job = *w.job;
+        send(job.client, type, job.id, body);
+        uint64_t now = nowUs();
+        if (latencies.size() < 1024) { latencies.push_back(now - job.receivedUs); waits.push_back(w.startedUs - job.receivedUs); }
+        else { latencies[sampleAt] = now - job.receivedUs; waits[sampleAt] = w.startedUs - job.receivedUs; sampleAt = (sampleAt + 1) % 1024; }
+        ++completed;
+        if (type == 'E') ++failed;
+        w.job.reset();
+    };
+    auto metrics = [&]() {
+        auto percentile = [](std::vector<uint64_t> v, double q) -> uint64_t {
+            if (v.empty()) return 0;
+            size_t k = std::min(v.size() - 1, (size_t)(q * (double)v.size()));
+            std::nth_element(v.begin(), v.begin() + (long)k, v.end());
+            return v[k];
+        };
+        size_t busy = 0;
+        for (auto& w : workers) busy += w.job.has_value();
+        std::string m;
+        auto line = [&](const char* name, uint64_t v) { m += name; m += ' '; m += std::to_string(v); m += '\n'; };
+        line("workers", workers.size());
+        line("workers_busy", busy);
+        line("queue_depth", queue.size());
+        line("jobs_received", received);
+        line("jobs_completed", completed);
+        line("jobs_failed", failed);
+        line("worker_restarts", restarts);
+        line("latency_us_p50", percentile(latencies, 0.5));
+        line("latency_us_p90", percentile(latencies, 0.9));
+        line("latency_us_p99", percentile(latencies, 0.99));
+        line("latency_us_max", latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end()));
+        line("queue_wait_us_p50", percentile(waits, 0.5));
+        line("queue_wait_us_p99", percentile(waits, 0.99));
+        return m;
+    };
+    for (auto& w : workers) if (!spawn(w)) { std::cerr << "Cannot start worker: " << std::strerror(errno) << "\n"; return 1; }
+    std::cerr << "ulang: serving " << options.scriptPath << " on " << options.socketPath << " with " << workers.size() << " workers\n";
+    std::vector<pollfd> fds;
+    std::vector<uint64_t> polled;
+    int exitCode = 0;
+    while (!serveStopping) {
+        // Hand queued jobs to idle workers; jobs whose client has gone are dropped.
+        for (auto& w : workers) {
+            while (w.ready && !w.job && !queue.empty()) {
+                Job job = std::move(queue.front());
+                queue.pop_front();
+                if (!clients.count(job.client)) continue;
+                w.startedUs = nowUs();
+                w.out += makeFrame('J', job.payload);
+                w.job = std::move(job);
+                flushWorker(w);
+            }
+        }
+        // A worker still busy a second past its job's timeout is stuck outside the interpreter's checks.
+        int waitMs = 1000;
+        uint64_t now = nowUs();
+        for (auto& w : workers) {
+            if (!w.job || w.killed) continue;
+            uint32_t timeout = w.job->timeoutMs ? w.job->timeoutMs : (uint32_t)options.limits.timeoutMs;
+            if (!timeout) continue;
+            uint64_t hardDeadline = w.startedUs + ((uint64_t)timeout + 1000) * 1000;
+            if (now >= hardDeadline) { kill(w.pid, SIGKILL); w.killed = true; }
+            else waitMs = std::min<int>(waitMs, (int)((hardDeadline - now) / 1000) + 1);
+        }
+        fds.clear();
+        fds.push_back({listener, POLLIN, 0});
+        for (auto& w : workers) fds.push_back({w.fd, (short)(POLLIN | (w.out.empty() ? 0 : POLLOUT)), 0});
+        polled.clear();
+        for (auto& c : clients) {
+            fds.push_back({c.second.fd, (short)(POLLIN | (c.second.out.empty() ? 0 : POLLOUT)), 0});
+            polled.push_back(c.first);
+        }
+        if (poll(fds.data(), fds.size(), waitMs) < 0 && errno != EINTR) break;
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) clients[nextClient++] = Client{fd, "", ""};
+        }
+        char chunk[65536];
+        std::string payload;
+        char type;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            Worker& w = workers[i];
+            if (fds[1 + i].revents & POLLOUT) flushWorker(w);
+            if (!(fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            bool gone = false;
+            while (true) {
+                ssize_t n = read(w.fd, chunk, sizeof chunk);
+                if (n > 0) { w.in.append(chunk, (size_t)n); continue; }
+                if (n == 0 || (errno != EAGAIN && errno != EINTR)) gone = true;
+                if (n < 0 && errno == EINTR) continue;
+                break;
+            }
+            while (takeFrame(w.in, type, payload)) {
+                if (type == 'W') w.ready = true;
+                else if (type == 'X') { std::cerr << payload << "\n"; serveStopping = 1; exitCode = 1; }
+                else if (w.job && type == 'O') send(w.job->client, 'O', w.job->id, payload);
+                else if (w.job && (type == 'R' || type == 'E')) finish(w, type, payload);
+            }
+            if (gone) {
+                close(w.fd);
+                waitpid(w.pid, nullptr, 0);
+                if (w.job) {
+                    std::string body;
+                    putString(body, w.killed ? "ResourceLimitError" : "WorkerCrashed");
+                    putString(body, w.killed ? "Job did not stop at its timeout; its worker was killed" : "The worker running this job exited");
+                    putU32(body, 0);
+                    finish(w, 'E', body);
+                }
+                if (serveStopping) { w.fd = -1; w.pid = -1; continue; }
+                ++restarts;
+                if (!spawn(w)) { std::cerr << "Cannot restart worker: " << std::strerror(errno) << "\n"; serveStopping = 1; exitCode = 1; }
+            }
+        }
+        for (size_t i = 1 + workers.size(); i < fds.size(); ++i) {
+            auto it = clients.find(polled[i - 1 - workers.size()]);
+            if (it == clients.end()) continue;
+            Client& c = it->second;
+            bool closed = false;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                while (true) {
+                    ssize_t n = read(c.fd, chunk, sizeof chunk);
+                    if (n > 0) { c.in.append(chunk, (size_t)n); continue; }
+                    if (n == 0 || (errno != EAGAIN && errno != EINTR)) closed = true;
+                    if (n < 0 && errno == EINTR) continue;
+                    break;
+                }
+                while (!closed && takeFrame(c.in, type, payload)) {
+                    if (type == 'M') { c.out += makeFrame('M', metrics()); continue; }
+                    if (type != 'J' || payload.size() < 8) { closed = true; break; }
+                    Job job{it->first, 0, 0, std::move(payload), nowUs()};
+                    std::memcpy(&job.id, job.payload.data(), 4);
+                    std::memcpy(&job.timeoutMs, job.payload.data() + 4, 4);
+                    queue.push_back(std::move(job));
+                    ++received;
+                }
+                if (c.in.size() > ((size_t)64 << 20)) closed = true;
+            }
+            if (!closed && !c.out.empty()) {
+                ssize_t n = write(c.fd, c.out.data(), c.out.size());
+                if (n > 0) c.out.erase(0, (size_t)n);
+                else if (n < 0 && errno != EAGAIN && errno != EINTR) closed = true;
+            }
+            if (closed) { close(c.fd); clients.erase(it); }
+        }
+    }
+    for (auto& w : workers) if (w.pid > 0) { kill(w.pid, SIGTERM); close(w.fd); waitpid(w.pid, nullptr, 0); }
+    for (auto& c : clients) close(c.second.fd);
+    close(listener);
+    unlink(options.socketPath.c_str());
+    return exitCode;
+}
+int main(int argc, char* argv[]) {
+    bool dumpAst = false;
+    bool optimize = true;
+    bool stream = false;
+    size_t maxDepth = 10000;
+    ResourceLimits limits;
+    bool stats = false;
+    std::string tracePath;
+    uint64_t traceThresholdUs = 100;
+    std::vector<std::string> searchPath;
+    std::string path, servePath;
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool valid = true;
+        if (arg == "--dump-ast") dumpAst = true;
+        else if (arg == "-O0") optimize = false;
+        else if (arg == "--stream") stream = true;
+        else if (arg == "--max-depth" && i + 1 < argc) valid = parseCount(argv[++i], maxDepth);
+        else if (arg == "--max-steps" && i + 1 < argc) valid = parseCount(argv[++i], limits.maxSteps);
+        else if (arg == "--max-heap" && i + 1 < argc) valid = parseByteSize(argv[++i], limits.maxHeapBytes);
+        else if (arg == "--timeout" && i + 1 < argc) valid = parseCount(argv[++i], limits.timeoutMs);
+        else if (arg == "--stats") stats = true;
+        else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+        else if (arg == "--trace-threshold" && i + 1 < argc) valid = parseCount(argv[++i], traceThresholdUs);
+        else if (arg == "--path" && i + 1 < argc) searchPath.push_back(argv[++i]);
+        else if (arg == "--serve" && i + 1 < argc) servePath = argv[++i];
+        else if (arg == "--workers" && i + 1 < argc) valid = parseCount(argv[++i], workers) && workers > 0;
+        else path = arg;
+        if (!valid) {
+            std::cerr << "Invalid value for " << arg << ": " << argv[i] << "\n";
+            return 1;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: ulang [--dump-ast] [-O0] [--stream] [--max-depth N] [--max-steps N] [--max-heap SIZE] [--timeout MS] [--stats] [--trace out.json] [--trace-threshold US] [--path DIR] file.ul | -\n"
+                     "       ulang --serve SOCKET [--workers N] [limit options] [--path DIR] file.ul\n";
+        return 1;
+    }
+    // ULANG_PATH holds further import directories, separated by ':'.
+    if (const char* env = std::getenv("ULANG_PATH")) {
+        std::stringstream dirs(env);
+        for (std::string dir; std::getline(dirs, dir, ':');) if (!dir.empty()) searchPath.push_back(dir);
     }
+    if (!servePath.empty()) {
+        if (path == "-") { std::cerr << "--serve needs a script file\n"; return 1; }
+        ServeOptions options{servePath, path, workers, optimize, maxDepth, limits, searchPath};
+        return serveJobs(options);
+    }
+    std::ios::sync_with_stdio(false);
+    std::ifstream f;
+    ChunkReader reader;
+    if (path == "-") {
+        // Piped sources are always executed statement by statement as they arrive.
+        stream = true;
+        reader = readFd(STDIN_FILENO);
+    } else {
+        f.open(path, std::ios::binary);
+        if (!f) { std::cerr << "Cannot open " << path << "\n"; return 1; }
+        reader = readStream(f);
+    }
+    object_counting = stats || !tracePath.empty();
+    size_t stackBytes = std::max<size_t>(64 * 1024 * 1024, maxDepth * NATIVE_STACK_PER_CALL);
+    runOnInterpreterStack(stackBytes, [&](const char* stackBase, size_t stackSize) {
+        Interpreter interpreter;
+        interpreter.searchPath = searchPath;
+        char resolved[PATH_MAX];
+        if (path != "-" && realpath(path.c_str(), resolved)) interpreter.mainModule->path = resolved;
+        limits.maxDepth = maxDepth;
+        interpreter.setLimits(limits);
+        interpreter.nativeStackBase = stackBase;
+        interpreter.nativeStackSize = stackSize;
+        Tracer& tracer = interpreter.tracer;
+        tracer.stats = stats;
+        tracer.tracing = !tracePath.empty();
+        tracer.thresholdUs = traceThresholdUs;
+        tracer.threadName(1, "main");
+        try {
+            Lexer lexer(reader);
+            Parser parser(lexer);
+            if (stream) {
+                // Statements are parsed and run alternately; each phase is only a span when it is long enough.
+                Optimizer optimizer(interpreter, dumpAst, false);
+                while (!parser.isAtEnd() && !interpreter.returning) {
+                    uint64_t started = tracer.nowUs();
+                    std::vector<std::shared_ptr<ASTNode>> stmt = {parser.declaration()};
+                    if (optimize) stmt = optimizer.run(stmt);
+                    else if (dumpAst) Optimizer::dumpProgram("(unoptimised)", stmt);
+                    uint64_t parsed = tracer.nowUs();
+                    tracer.parseUs += parsed - started;
+                    if (parsed - started >= tracer.thresholdUs) tracer.span("parse", "phase", started);
+                    interpreter.executeBlock(stmt);
+                    uint64_t executed = tracer.nowUs() - parsed;
+                    tracer.executeUs += executed;
+                    if (executed >= tracer.thresholdUs) tracer.span("execute", "phase", parsed);
+                }
+                uint64_t started = tracer.nowUs();
+                interpreter.loop.run();
+                tracer.executeUs += tracer.nowUs() - started;
+                tracer.span("event loop", "phase", started);
+            } else {
+                uint64_t started = tracer.nowUs();
+                auto nodes = parser.parse();
+                tracer.parseUs = tracer.nowUs() - started;
+                tracer.span("parse", "phase", started);
+                if (optimize) {
+                    uint64_t optimizeStarted = tracer.nowUs();
+                    nodes = Optimizer(interpreter, dumpAst).run(nodes);
+                    tracer.span("optimize", "phase", optimizeStarted);
+                } else if (dumpAst) Optimizer::dumpProgram("(unoptimised)", nodes);
+                started = tracer.nowUs();
+                interpreter.executeBlock(nodes);
+                interpreter.loop.run();
+                tracer.executeUs = tracer.nowUs() - started;
+                tracer.span("execute", "phase", started);
+            }
+        } catch (ULangError& e) {
+            std::cerr << e.getFullMessage() << "\n";
+        } catch (std::exception& e) {
+            std::cerr << "INTERNAL ERROR: " << e.what() << "\n";
+        }
+        std::cout.flush();
+        tracer.sample(interpreter.depth, true);
+        if (stats) tracer.printStats(std::cerr, interpreter.memoCaches);
+        if (tracer.tracing && !tracer.writeTrace(tracePath)) std::cerr << "Cannot write trace to " << tracePath << "\n";
+    });
     return 0;
 }
@@ -0,0 +1,24 @@
+#!/bin/sh
+# A first assignment defines the name without throwing: --stats counts no errors for a loop full of
+# fresh locals, and exactly one for a single caught error.
+cd "$(dirname "$0")/.." || exit 1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cat > "$dir/fresh.ul" <<'EOF2'
+function fresh(n) {
+    p = n
+    q = p + 1
+    return q
+}
+i = 0
+while (i < 1000) {
+    total = fresh(i)
+    i = i + 1
+}
+EOF2
+printf 'try { missing } catch (e) { }\n' > "$dir/one.ul"
+for case in "fresh 0" "one 1"; do
+    set -- $case
+    thrown=$(./ulang --stats "$dir/$1.ul" 2>&1 | sed -n 's/^errors thrown: *//p')
+    if [ "$thrown" != "$2" ]; then echo "$1.ul: $thrown errors thrown, expected $2"; exit 1; fi
+done
@@ -0,0 +1,6 @@
+#!/bin/sh
+# The optimiser must not change what a program prints: tests/optimizer.ul gives the same stdout at -O0.
+cd "$(dirname "$0")/.." || exit 1
+optimised=$(./ulang tests/optimizer.ul 2> /dev/null)
+plain=$(./ulang -O0 tests/optimizer.ul 2> /dev/null)
+if [ "$optimised" != "$plain" ]; then printf 'optimised:\n%s\n-O0:\n%s\n' "$optimised" "$plain"; exit 1; fi
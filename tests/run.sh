@@ -0,0 +1,18 @@
+#!/bin/sh
+# Runs each tests/*.ul and compares its stdout and stderr with the .out file beside it.
+# A first line "// flags: ..." passes options to ulang; UPDATE=1 rewrites the .out files.
+# Any tests/*.sh besides this one is run as well and must exit 0.
+cd "$(dirname "$0")/.." || exit 1
+failed=0
+for t in tests/*.ul; do
+    flags=$(sed -n '1s|^// flags: ||p' "$t")
+    actual=$(./ulang $flags "$t" 2>&1)
+    if [ -n "$UPDATE" ]; then printf '%s\n' "$actual" > "${t%.ul}.out"; continue; fi
+    if printf '%s\n' "$actual" | diff -u "${t%.ul}.out" - > /tmp/ulang-test.diff; then echo "ok   $t"
+    else echo "FAIL $t"; cat /tmp/ulang-test.diff; failed=1; fi
+done
+for t in tests/*.sh; do
+    [ "$t" = tests/run.sh ] && continue
+    if sh "$t"; then echo "ok   $t"; else echo "FAIL $t"; failed=1; fi
+done
+exit $failed
@@ -0,0 +1,107 @@
+#!/bin/sh
+# --serve over a Unix socket: streamed output, results, script errors, a missing entry function, the
+# interpreter's timeout, a worker killed and replaced when a job blocks past its timeout, metrics, a
+# multi-megabyte argument, a job whose client hung up not replying to the next connection, and no
+# job seeing what an earlier one changed. Skipped without python3.
+cd "$(dirname "$0")/.." || exit 1
+command -v python3 > /dev/null || { echo "skip: no python3"; exit 0; }
+dir=$(mktemp -d)
+mkfifo "$dir/fifo"
+cat > "$dir/jobs.ul" <<'EOF'
+function echo(x) { return x }
+async function later(ms) {
+    await sleep(ms)
+    return "late"
+}
+seen = []
+count = 0
+function add(x) {
+    seen.append(x)
+    count = count + 1
+    return [len(seen), count]
+}
+function talk(n) {
+    i = 0
+    while (i < n) {
+        output("line", i)
+        i = i + 1
+    }
+    return "done"
+}
+function boom() { return undefined_name }
+function spin() {
+    while (true) { }
+}
+// Opening a FIFO nobody writes to blocks outside the interpreter's checks.
+function stuck(path) { return read_file(path) }
+EOF
+./ulang --serve "$dir/sock" --workers 1 "$dir/jobs.ul" 2> "$dir/log" &
+server=$!
+trap 'kill $server 2> /dev/null; wait $server 2> /dev/null; rm -rf "$dir"' EXIT
+for _ in $(seq 50); do [ -S "$dir/sock" ] && break; sleep 0.1; done
+python3 - "$dir/sock" "$dir/fifo" <<'EOF'
+import socket, struct, sys, time
+socket.setdefaulttimeout(10)
+def string(b): return struct.pack("<I", len(b)) + (b.encode() if isinstance(b, str) else b)
+def value(v):
+    if isinstance(v, int): return b"i" + struct.pack("<q", v)
+    if isinstance(v, (bytes, str)): return b"s" + string(v)
+    return b"l" + struct.pack("<I", len(v)) + b"".join(value(x) for x in v)
+def frame(kind, body): return struct.pack("<I", len(body)) + kind + body
+def job(id, entry, args, timeout=0):
+    return frame(b"J", struct.pack("<II", id, timeout) + string(entry) + struct.pack("<I", len(args)) + b"".join(value(a) for a in args))
+def connect():
+    c = socket.socket(socket.AF_UNIX)
+    c.connect(sys.argv[1])
+    return c
+def exact(c, n):
+    b = b""
+    while len(b) < n:
+        more = c.recv(n - len(b))
+        if not more: sys.exit("connection closed")
+        b += more
+    return b
+def reply(c):
+    n, = struct.unpack("<I", exact(c, 4))
+    kind = exact(c, 1)
+    body = exact(c, n)
+    if kind == b"M": return kind, 0, body
+    return kind, struct.unpack("<I", body[:4])[0], body[4:]
+def error(type, message, line): return string(type) + string(message) + struct.pack("<I", line)
+# Sends a job and returns every frame up to and including its R or E.
+def run(c, id, entry, args, timeout=0):
+    c.sendall(job(id, entry, args, timeout))
+    frames = []
+    while not frames or frames[-1][0] not in (b"R", b"E"): frames.append(reply(c))
+    return frames
+def expect(what, got, wanted):
+    if got != wanted: sys.exit("%s:\n  got    %r\n  wanted %r" % (what, got, wanted))
+c = connect()
+expect("streamed output", run(c, 1, "talk", [2]),
+       [(b"O", 1, b"line 0 \n"), (b"O", 1, b"line 1 \n"), (b"R", 1, value("done"))])
+expect("script error", run(c, 2, "boom", []), [(b"E", 2, error("Runtime", "Undefined variable 'undefined_name'.", 21))])
+expect("missing entry", run(c, 3, "nope", []), [(b"E", 3, error("Runtime", "No function 'nope' in " + sys.argv[1][:-4] + "jobs.ul", 0))])
+expect("timeout", run(c, 4, "spin", [], 200), [(b"E", 4, error("ResourceLimitError", "Timeout (200 ms) exceeded", 23))])
+start = time.time()
+expect("hard timeout", run(c, 5, "stuck", [sys.argv[2]], 200),
+       [(b"E", 5, error("ResourceLimitError", "Job did not stop at its timeout; its worker was killed", 0))])
+if not 1.1 < time.time() - start < 5: sys.exit("worker killed after %.2f s, not a second past the timeout" % (time.time() - start))
+expect("replacement worker", run(c, 6, "echo", [7]), [(b"R", 6, value(7))])
+c.sendall(frame(b"M", b""))
+kind, _, body = reply(c)
+metrics = dict(line.split(" ") for line in body.decode().splitlines())
+expect("metrics", (kind, {k: metrics[k] for k in ("workers", "jobs_received", "jobs_completed", "jobs_failed", "worker_restarts")}),
+       (b"M", {"workers": "1", "jobs_received": "6", "jobs_completed": "6", "jobs_failed": "4", "worker_restarts": "1"}))
+big = b"0123456789abcdef" * (6 << 16)
+expect("big argument", run(c, 7, "echo", [big]), [(b"R", 7, value(big))])
+c.close()
+gone = connect()
+gone.sendall(job(8, "later", [300]))
+time.sleep(0.1)
+gone.close()
+time.sleep(0.1)
+c = connect()
+expect("reply after a client hung up", run(c, 9, "echo", ["mine"]), [(b"R", 9, value("mine"))])
+for id in (10, 11, 12):
+    expect("state reset", run(c, id, "add", [id]), [(b"R", id, value([1, 1]))])
+EOF
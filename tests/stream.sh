@@ -0,0 +1,36 @@
+#!/bin/sh
+# Source piped to `ulang -` runs statement by statement: what a statement prints arrives before the
+# next line is sent, and a statement that may continue waits for the next word. Skipped without python3.
+cd "$(dirname "$0")/.." || exit 1
+command -v python3 > /dev/null || { echo "skip: no python3"; exit 0; }
+python3 - <<'EOF'
+import select, subprocess, sys
+p = subprocess.Popen(["./ulang", "-"], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+# Sends one line and returns what was printed before a short wait ran out.
+def send(line, wait):
+    p.stdin.write(line.encode())
+    p.stdin.flush()
+    out = b""
+    while select.select([p.stdout], [], [], wait)[0]:
+        out += p.stdout.read1(4096)
+        if out.endswith(b"\n"): wait = 0.2
+    return out.decode()
+steps = [
+    ('output("one");\n', "one \n"),
+    ("x = 2\n", ""),                        # may continue: `x = 2 + ...`
+    ("output(x)\n", ""),                    # runs x = 2, then waits itself
+    ("while (x < 4) { x = x + 1 }\n", "2 \n"),
+    ('if (x > 3) { output("big") };\n', "big \n"),
+    ('if (x > 3) { output("then") }\n', ""),  # may still get an else
+    ('else { output("else") }\n', "then \n"),
+    ("function f(a) { return a * 2 }\n", ""),
+    ("output(f(x));\n", "8 \n"),
+]
+for line, wanted in steps:
+    got = send(line, 2 if wanted else 0.3)
+    if got != wanted: sys.exit("after sending %r:\n  got    %r\n  wanted %r" % (line, got, wanted))
+p.stdin.close()
+rest = p.stdout.read().decode()
+p.wait()
+if rest: sys.exit("left over at end of input: %r" % rest)
+EOF
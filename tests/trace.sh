@@ -0,0 +1,67 @@
+#!/bin/sh
+# --trace writes Chrome trace-event JSON: phase spans, one span per call at threshold 0 (nested per
+# track, async tasks on their own named tracks), and counters; --stats agrees on the call count.
+# Skipped without python3.
+cd "$(dirname "$0")/.." || exit 1
+command -v python3 > /dev/null || { echo "skip: no python3"; exit 0; }
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cat > "$dir/trace.ul" <<'EOF'
+function fib(n) {
+    if (n < 2) { return n }
+    return fib(n - 1) + fib(n - 2)
+}
+async function job(ms) {
+    await sleep(ms)
+    return fib(10)
+}
+output(fib(12))
+output(await gather([job(1), job(2)]))
+EOF
+./ulang --trace "$dir/trace.json" --trace-threshold 0 --stats "$dir/trace.ul" > "$dir/out" 2> "$dir/stats" || exit 1
+python3 - "$dir" <<'EOF'
+import collections, json, sys
+dir = sys.argv[1]
+def check(ok, what):
+    if not ok: sys.exit("trace: " + what)
+check(open(dir + "/out").read() == "144 \n[55, 55] \n", "wrong program output")
+trace = json.load(open(dir + "/trace.json"))
+check(set(trace) == {"displayTimeUnit", "traceEvents"}, "unexpected top-level keys %s" % sorted(trace))
+events = trace["traceEvents"]
+check(len({e["pid"] for e in events}) == 1, "events from more than one pid")
+for e in events:
+    check({"name", "cat", "ph", "ts", "pid", "tid"} <= set(e), "event missing a field: %r" % e)
+    check(e["ph"] in ("X", "C", "M"), "unexpected phase: %r" % e)
+    check(isinstance(e["ts"], int) and e["ts"] >= 0, "bad timestamp: %r" % e)
+    if e["ph"] == "X": check(isinstance(e["dur"], int) and e["dur"] >= 0, "bad duration: %r" % e)
+threads = {e["tid"]: e["args"]["name"] for e in events if e["ph"] == "M" and e["name"] == "thread_name"}
+check(threads == {1: "main", 2: "task job", 3: "task job"}, "thread names %r" % threads)
+phases = [e for e in events if e["ph"] == "X" and e["cat"] == "phase"]
+check([p["name"] for p in sorted(phases, key=lambda p: p["ts"])] == ["parse", "optimize", "execute"], "phases %r" % phases)
+check(all(p["tid"] == 1 for p in phases), "phase spans off the main track")
+parse, optimize, execute = sorted(phases, key=lambda p: p["ts"])
+check(parse["ts"] + parse["dur"] <= optimize["ts"] and optimize["ts"] + optimize["dur"] <= execute["ts"], "phases overlap")
+calls = [e for e in events if e["ph"] == "X" and e["cat"] == "call"]
+counts = collections.Counter((e["tid"], e["name"]) for e in calls)
+check(counts == {(1, "fib"): 465, (2, "job"): 1, (2, "fib"): 177, (3, "job"): 1, (3, "fib"): 177}, "call spans %r" % counts)
+end = execute["ts"] + execute["dur"]
+check(all(execute["ts"] <= c["ts"] and c["ts"] + c["dur"] <= end for c in calls if c["tid"] == 1), "main-track call outside execute")
+# Spans on one track nest: each starts and ends within whichever enclosing span is still open.
+for tid in threads:
+    open_ends = []
+    for s in sorted((e for e in calls if e["tid"] == tid), key=lambda e: (e["ts"], -e["dur"])):
+        while open_ends and open_ends[-1] <= s["ts"]: open_ends.pop()
+        check(not open_ends or s["ts"] + s["dur"] <= open_ends[-1], "spans on track %d overlap: %r" % (tid, s))
+        open_ends.append(s["ts"] + s["dur"])
+counters = collections.defaultdict(list)
+for e in events:
+    if e["ph"] == "C": counters[e["name"]].append((e["ts"], e["args"]["value"]))
+check(set(counters) == {"heap objects", "env depth", "allocations"}, "counters %r" % sorted(counters))
+for name, samples in counters.items():
+    check(all(isinstance(v, int) and v >= 0 for _, v in samples), "negative or non-integer %s" % name)
+allocations = [v for _, v in sorted(counters["allocations"])]
+check(allocations == sorted(allocations), "allocation counter goes down")
+stats = dict(line.split(":", 1) for line in open(dir + "/stats").read().splitlines()[1:])
+check(set(stats) == {"parse", "execute", "calls", "errors thrown", "allocations", "heap objects", "http", "modules"}, "stats keys %r" % sorted(stats))
+check(int(stats["calls"]) == len(calls) and int(stats["errors thrown"]) == 0, "stats %r" % stats)
+EOF